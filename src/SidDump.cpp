@@ -0,0 +1,138 @@
+//============================================================================
+// Description : Table of SID registers per play call, like siddump
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cstring>
+
+#include "SidDump.h"
+
+static const struct
+{
+    const char *name;  /* CSV column */
+    const char *title; /* text column, digits wide */
+    int digits;
+} fields[SIDDUMP_FIELDS] = {
+    { "v1_freq", "Freq", 4 }, { "v1_pw", "PW ", 3 }, { "v1_wave", "WF", 2 }, { "v1_adsr", "ADSR", 4 },
+    { "v2_freq", "Freq", 4 }, { "v2_pw", "PW ", 3 }, { "v2_wave", "WF", 2 }, { "v2_adsr", "ADSR", 4 },
+    { "v3_freq", "Freq", 4 }, { "v3_pw", "PW ", 3 }, { "v3_wave", "WF", 2 }, { "v3_adsr", "ADSR", 4 },
+    { "cutoff", "Cut", 3 }, { "res_filt", "RF", 2 }, { "mode_vol", "MV", 2 },
+};
+
+/* text columns are grouped per voice and filter */
+static const char *separator(int field)
+{
+    return field == 0 ? "| " : field % 4 == 0 ? " | " : " ";
+}
+
+static void read_fields(const uint8_t *r, uint32_t *f)
+{
+    for (int v = 0; v < 3; v++) {
+        const uint8_t *voice = r + v * 7;
+        f[v * 4 + 0] = voice[0] | (voice[1] << 8);
+        f[v * 4 + 1] = voice[2] | ((voice[3] & 0x0F) << 8);
+        f[v * 4 + 2] = voice[4];
+        f[v * 4 + 3] = (voice[5] << 8) | voice[6];
+    }
+    f[12] = (r[0x15] & 0x07) | (r[0x16] << 3);
+    f[13] = r[0x17];
+    f[14] = r[0x18];
+}
+
+SidDump::SidDump(FILE *out, int format, bool changed_only, int sid_count, uint32_t clock_hz)
+{
+    this->out = out;
+    this->format = format;
+    changedOnly = changed_only;
+    sidCount = sid_count < 1 ? 1 : sid_count > SIDLOG_MAX_SIDS ? SIDLOG_MAX_SIDS : sid_count;
+    clockHz = clock_hz ? clock_hz : 985248;
+    memset(last, 0, sizeof(last));
+    first = true;
+    pending.reserve(SIDDUMP_BUFFER);
+}
+
+SidDump::~SidDump()
+{
+    Flush();
+}
+
+void SidDump::Emit()
+{
+    pending.append(line);
+    pending.push_back('\n');
+    if (pending.size() >= SIDDUMP_BUFFER) Flush();
+}
+
+void SidDump::Flush()
+{
+    if (pending.empty()) return;
+    fwrite(pending.data(), 1, pending.size(), out);
+    fflush(out);
+    pending.clear();
+}
+
+void SidDump::Header()
+{
+    char *p = line;
+    char *end = line + sizeof(line);
+    if (format == SIDDUMP_CSV) {
+        p += snprintf(p, end - p, "frame,time");
+        for (int c = 0; c < sidCount; c++) {
+            for (int i = 0; i < SIDDUMP_FIELDS; i++) {
+                p += snprintf(p, end - p, ",s%d_%s", c + 1, fields[i].name);
+            }
+        }
+    } else {
+        p += snprintf(p, end - p, "| Frame  | Time     ");
+        for (int c = 0; c < sidCount; c++) {
+            for (int i = 0; i < SIDDUMP_FIELDS; i++) {
+                p += snprintf(p, end - p, "%s%s", separator(i), fields[i].title);
+            }
+            p += snprintf(p, end - p, " ");
+        }
+        p += snprintf(p, end - p, "|");
+    }
+    Emit();
+}
+
+void SidDump::Row(uint64_t frame, uint64_t cycles, const uint8_t *registers)
+{
+    uint32_t now[SIDLOG_MAX_SIDS][SIDDUMP_FIELDS];
+    bool changed = first;
+    for (int c = 0; c < sidCount; c++) {
+        read_fields(registers + c * 32, now[c]);
+        changed = changed || memcmp(now[c], last[c], sizeof(now[c])) != 0;
+    }
+    if (changedOnly && !changed) return;
+
+    char *p = line;
+    char *end = line + sizeof(line);
+    uint64_t hundredths = cycles * 100 / clockHz;
+    if (format == SIDDUMP_CSV) {
+        p += snprintf(p, end - p, "%llu,%.4f", (unsigned long long)frame, (double)cycles / clockHz);
+    } else {
+        p += snprintf(p, end - p, "| %6llu | %02u:%02u.%02u ", (unsigned long long)frame,
+                      (unsigned)(hundredths / 6000), (unsigned)(hundredths / 100 % 60), (unsigned)(hundredths % 100));
+    }
+    for (int c = 0; c < sidCount; c++) {
+        for (int i = 0; i < SIDDUMP_FIELDS; i++) {
+            bool show = !changedOnly || first || now[c][i] != last[c][i];
+            if (format == SIDDUMP_CSV) {
+                p += show ? snprintf(p, end - p, ",%u", now[c][i]) : snprintf(p, end - p, ",");
+            } else {
+                p += snprintf(p, end - p, "%s", separator(i));
+                if (show)
+                    p += snprintf(p, end - p, "%0*X", fields[i].digits, now[c][i]);
+                else
+                    p += snprintf(p, end - p, "%.*s", fields[i].digits, "....");
+            }
+        }
+        if (format != SIDDUMP_CSV) p += snprintf(p, end - p, " ");
+    }
+    if (format != SIDDUMP_CSV) p += snprintf(p, end - p, "|");
+    Emit();
+
+    memcpy(last, now, sizeof(last));
+    first = false;
+}
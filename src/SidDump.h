@@ -0,0 +1,50 @@
+//============================================================================
+// Description : Table of SID registers per play call, like siddump
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "SidLog.h"
+
+#define SIDDUMP_TEXT 0
+#define SIDDUMP_CSV  1
+#define SIDDUMP_BUFFER (1 << 20)  // rows collected before they are written out
+
+// Per chip: frequency, pulse width, waveform and ADSR of every voice,
+// then filter cutoff, resonance/routing and mode/volume
+#define SIDDUMP_FIELDS 15
+
+// Writes one row per frame with the register file after the play call.
+// Text rows are in hex as in siddump; CSV has decimal numbers. With
+// changed_only a field that kept its value since the previous row is
+// left out ("...." in text, empty in CSV) and rows without any change
+// are skipped. Rows are written to out in large blocks, Flush sends
+// the rest.
+class SidDump
+{
+private:
+    FILE *out;
+    int format;
+    bool changedOnly;
+    int sidCount;
+    uint32_t clockHz;
+    uint32_t last[SIDLOG_MAX_SIDS][SIDDUMP_FIELDS];
+    bool first;
+    char line[2048];
+    std::string pending;
+
+    void Emit();
+
+public:
+    SidDump(FILE *out, int format, bool changed_only, int sid_count, uint32_t clock_hz);
+    ~SidDump();
+    void Header();
+    // registers holds 32 bytes per chip; cycles is the time of the frame
+    void Row(uint64_t frame, uint64_t cycles, const uint8_t *registers);
+    void Flush();
+};
@@ -0,0 +1,539 @@
+//============================================================================
+// Description : Software SID for rendering without hardware
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cmath>
+#include <cstring>
+
+#include "SidEmu.h"
+
+#define ENV_ATTACK  0
+#define ENV_DECAY   1  /* and sustain */
+#define ENV_RELEASE 2
+
+#define CTRL_GATE  0x01
+#define CTRL_SYNC  0x02
+#define CTRL_RING  0x04
+#define CTRL_TEST  0x08
+
+/* cycles per envelope step for each rate nibble */
+static const uint16_t rate_period[16] = {
+    9, 32, 63, 95, 149, 220, 267, 313, 392, 977, 1954, 3126, 3907, 11720, 19532, 31251
+};
+
+int sidemu_model(int chip_type)
+{
+    return chip_type == 2 ? SIDEMU_8580 : SIDEMU_6581;
+}
+
+/* the envelope slows down at these levels while decaying */
+static int exp_period(uint8_t level)
+{
+    return level > 0x5D ? 1 : level > 0x36 ? 2 : level > 0x1A ? 4 : level > 0x0E ? 8 : level > 0x06 ? 16 : level ? 30 : 1;
+}
+
+SidChip::SidChip()
+{
+    Reset(SIDEMU_6581, 44100);
+}
+
+void SidChip::Reset(int model, uint32_t sample_rate)
+{
+    this->model = model;
+    memset(voice, 0, sizeof(voice));
+    memset(regs, 0, sizeof(regs));
+    for (Voice &v : voice) {
+        v.noise = 0x7FFFF8;
+        v.state = ENV_RELEASE;
+        v.ratePeriod = rate_period[0];
+    }
+    waveZero = (model == SIDEMU_6581 ? 0x380 : 0x800);
+    mixerDC = (model == SIDEMU_6581 ? -0.11f : 0.0f);
+
+    /* 8580: close to linear, 30 Hz to 12 kHz; 6581: steep exponential
+       part from about 220 Hz to 18 kHz, no two chips are alike anyway */
+    for (int i = 0; i < 2048; i++) {
+        float x = i / 2047.0f;
+        float hz = (model == SIDEMU_8580 ? 30.0f + 12000.0f * x
+                                         : 220.0f + 17780.0f * (expf(3.2f * x) - 1.0f) / (expf(3.2f) - 1.0f));
+        if (hz > sample_rate * 0.45f) hz = sample_rate * 0.45f;
+        cutoff[i] = 2.0f * sinf((float)M_PI * hz / (2.0f * sample_rate));  /* run twice per sample */
+    }
+    for (int i = 0; i < 16; i++) {
+        resonance[i] = 1.0f / (0.707f + i * (1.5f / 15.0f));
+    }
+    lp = bp = 0;
+}
+
+void SidChip::SetRate(Voice &v)
+{
+    int rate = (v.state == ENV_ATTACK ? v.attackDecay >> 4 : v.state == ENV_DECAY ? v.attackDecay & 0x0F : v.sustainRelease & 0x0F);
+    v.ratePeriod = rate_period[rate];
+}
+
+void SidChip::Write(uint8_t reg, uint8_t value)
+{
+    reg &= 0x1F;
+    regs[reg] = value;
+    if (reg >= 21) return;  /* filter and volume are read when mixing */
+
+    Voice &v = voice[reg / 7];
+    switch (reg % 7) {
+    case 0: v.freq = (v.freq & 0xFF00) | value; break;
+    case 1: v.freq = (v.freq & 0x00FF) | (value << 8); break;
+    case 2: v.pw = (v.pw & 0x0F00) | value; break;
+    case 3: v.pw = (v.pw & 0x00FF) | ((value & 0x0F) << 8); break;
+    case 4:
+        if ((value & CTRL_GATE) && !(v.control & CTRL_GATE)) {
+            v.state = ENV_ATTACK;
+            SetRate(v);
+        } else if (!(value & CTRL_GATE) && (v.control & CTRL_GATE)) {
+            v.state = ENV_RELEASE;
+            SetRate(v);
+        }
+        if (value & CTRL_TEST) {
+            v.acc = 0;
+            v.noise = 0x7FFFF8;
+        }
+        v.control = value;
+        break;
+    case 5: v.attackDecay = value; SetRate(v); break;
+    case 6: v.sustainRelease = value; SetRate(v); break;
+    }
+}
+
+void SidChip::ClockEnvelope(Voice &v, uint32_t cycles)
+{
+    for (;;) {
+        /* a period set below the counter waits for the 15 bit wrap */
+        uint32_t remaining = (v.rateCounter < v.ratePeriod ? v.ratePeriod - v.rateCounter
+                                                           : 0x8000 - v.rateCounter + v.ratePeriod);
+        if (cycles < remaining) {
+            v.rateCounter = (v.rateCounter + cycles) & 0x7FFF;
+            return;
+        }
+        cycles -= remaining;
+        v.rateCounter = 0;
+        if (v.state != ENV_ATTACK && ++v.expCounter < exp_period(v.level)) continue;
+        v.expCounter = 0;
+        switch (v.state) {
+        case ENV_ATTACK:
+            if (++v.level == 0xFF) {
+                v.state = ENV_DECAY;
+                SetRate(v);
+            }
+            break;
+        case ENV_DECAY:
+            if (v.level != (v.sustainRelease >> 4) * 0x11) v.level--;
+            break;
+        case ENV_RELEASE:
+            if (v.level) v.level--;
+            break;
+        }
+    }
+}
+
+/* the noise waveform taps of the LFSR */
+static inline uint32_t noise_output(uint32_t r)
+{
+    return ((r >> 11) & 0x800) | ((r >> 10) & 0x400) | ((r >> 7) & 0x200) | ((r >> 5) & 0x100) |
+           ((r >> 4) & 0x080) | ((r >> 1) & 0x040) | ((r << 1) & 0x020) | ((r << 2) & 0x010);
+}
+
+static inline uint32_t clock_noise(uint32_t r, uint32_t shifts)
+{
+    while (shifts--) {
+        r = ((r << 1) | (((r >> 22) ^ (r >> 17)) & 1)) & 0x7FFFFF;
+    }
+    return r;
+}
+
+/* rising edges of bit 19 while the accumulator advances from acc by delta */
+static inline uint32_t noise_edges(uint32_t acc, uint64_t delta)
+{
+    return (uint32_t)(((acc + delta + 0x80000) >> 20) - ((acc + 0x80000) >> 20));
+}
+
+/* no sync in the block: every accumulator step is independent */
+void SidChip::Oscillate(const SidBlock &block, const SidEmuKernels *k)
+{
+    int steps = block.samples * SIDEMU_SUBSTEPS;
+    for (int i = 0; i < 3; i++) {
+        Voice &v = voice[i];
+        if (v.control & CTRL_TEST) {
+            memset(acc[i], 0, steps * sizeof(uint32_t));
+        } else {
+            k->accumulate(v.acc, v.freq, block.ends, steps, acc[i]);
+        }
+        if ((v.control & 0x80) && !(v.control & CTRL_TEST)) {
+            uint32_t prev = v.acc;
+            for (int t = 0; t < steps; t++) {
+                v.noise = clock_noise(v.noise, noise_edges(prev, (uint64_t)v.freq * block.stepCycles[t]));
+                noise[i][t] = noise_output(v.noise);
+                prev = acc[i][t];
+            }
+        } else if (!(v.control & CTRL_TEST)) {
+            v.noise = clock_noise(v.noise, noise_edges(v.acc, (uint64_t)v.freq * block.ends[steps - 1]));
+        } else if (v.control & 0x80) {
+            for (int t = 0; t < steps; t++) noise[i][t] = noise_output(v.noise);
+        }
+        v.acc = acc[i][steps - 1];
+    }
+}
+
+/* one step of all oscillators, at most one MSB edge in it: freq * n < 2^23 */
+void SidChip::Step(uint32_t n)
+{
+    bool msbRising[3];
+    for (int i = 0; i < 3; i++) {
+        Voice &v = voice[i];
+        msbRising[i] = false;
+        if (!(v.control & CTRL_TEST)) {
+            uint32_t prev = v.acc;
+            v.acc = (v.acc + v.freq * n) & 0xFFFFFF;
+            msbRising[i] = !(prev & 0x800000) && (v.acc & 0x800000);
+            v.noise = clock_noise(v.noise, noise_edges(prev, (uint64_t)v.freq * n));
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        if ((voice[i].control & CTRL_SYNC) && msbRising[(i + 2) % 3]) voice[i].acc = 0;
+    }
+}
+
+/* sync resets a voice when its source's MSB rises, step by step */
+void SidChip::OscillateSync(const SidBlock &block)
+{
+    int steps = block.samples * SIDEMU_SUBSTEPS;
+    for (int t = 0; t < steps; t++) {
+        Step(block.stepCycles[t]);
+        for (int i = 0; i < 3; i++) {
+            acc[i][t] = voice[i].acc;
+            noise[i][t] = noise_output(voice[i].noise);
+        }
+    }
+}
+
+void SidChip::Render(const SidBlock &block, int32_t *filter, int32_t *direct)
+{
+    const SidEmuKernels *k = sidemu_active();
+    int steps = block.samples * SIDEMU_SUBSTEPS;
+    bool sync = false;
+    for (int i = 0; i < 3; i++) {
+        if ((voice[i].control & CTRL_SYNC) && !(voice[(i + 2) % 3].control & CTRL_TEST)) sync = true;
+    }
+    if (sync)
+        OscillateSync(block);
+    else
+        Oscillate(block, k);
+
+    for (int i = 0; i < 3; i++) {
+        Voice &v = voice[i];
+        bool audible = false;
+        if ((v.state == ENV_RELEASE && v.level == 0) || (v.state == ENV_DECAY && v.level == (v.sustainRelease >> 4) * 0x11)) {
+            /* the level holds, only the counters run */
+            ClockEnvelope(v, block.ends[steps - 1]);
+            int32_t level = v.level;
+            for (int t = 0; t < steps; t++) {
+                weight[t] = level * block.stepCycles[t];
+            }
+            audible = level != 0;
+        } else {
+            for (int t = 0; t < steps; t++) {
+                uint32_t n = block.stepCycles[t];
+                if (v.rateCounter + n < v.ratePeriod)
+                    v.rateCounter += n;
+                else
+                    ClockEnvelope(v, n);
+                weight[t] = v.level * (int32_t)n;
+                audible |= v.level != 0;
+            }
+        }
+        int32_t *sums = (regs[0x17] & (1 << i)) ? filter : (i != 2 || !(regs[0x18] & 0x80)) ? direct : nullptr;  /* voice 3 off */
+        if (!audible || sums == nullptr) continue;
+
+        SidWaveArgs args;
+        args.acc = acc[i];
+        args.source = acc[(i + 2) % 3];
+        args.noise = (v.control & 0x80) ? noise[i] : nullptr;
+        args.weight = weight;
+        args.control = v.control;
+        args.pw = v.pw;
+        args.zero = waveZero;
+        k->wave(args, block.samples, sums);
+    }
+}
+
+void SidChip::Clock(uint32_t cycles)
+{
+    bool sync = false;
+    for (int i = 0; i < 3; i++) {
+        if ((voice[i].control & CTRL_SYNC) && !(voice[(i + 2) % 3].control & CTRL_TEST)) sync = true;
+    }
+    for (Voice &v : voice) {
+        ClockEnvelope(v, cycles);
+    }
+    if (sync) {
+        for (uint32_t n; cycles; cycles -= n) {
+            n = cycles < 8 ? cycles : 8;
+            Step(n);
+        }
+        return;
+    }
+    for (Voice &v : voice) {
+        if (v.control & CTRL_TEST) continue;
+        v.noise = clock_noise(v.noise, noise_edges(v.acc, (uint64_t)v.freq * cycles));
+        v.acc = (v.acc + v.freq * cycles) & 0xFFFFFF;
+    }
+}
+
+uint8_t SidChip::Read(uint8_t reg)
+{
+    const Voice &v = voice[2];
+    switch (reg & 0x1F) {
+    case 0x1B: {  /* OSC3, the top of voice 3's waveform */
+        int waveform = v.control >> 4;
+        if (waveform == 0) return 0;
+        uint32_t out = 0xFFF;
+        if (waveform & 1) {
+            uint32_t msb = ((v.control & CTRL_RING) ? v.acc ^ voice[1].acc : v.acc) & 0x800000;
+            out &= ((msb ? ~v.acc : v.acc) >> 11) & 0xFFF;
+        }
+        if (waveform & 2) out &= v.acc >> 12;
+        if (waveform & 4) out &= ((v.control & CTRL_TEST) || (v.acc >> 12) >= v.pw) ? 0xFFF : 0;
+        if (waveform & 8) out &= noise_output(v.noise);
+        return out >> 4;
+    }
+    case 0x1C:  /* ENV3 */
+        return v.level;
+    }
+    return 0;
+}
+
+void SidChip::Resync(uint8_t osc3, uint8_t env3)
+{
+    Voice &v = voice[2];
+    v.level = env3;
+    if ((v.control >> 4) == 2)  /* only a lone sawtooth tells the phase */
+        v.acc = (osc3 << 16) | (v.acc & 0xFFFF);
+}
+
+void SidChip::GetFilter(SidFilterArgs &args, int lane)
+{
+    /* Chamberlin state variable filter */
+    args.w[lane] = cutoff[(regs[0x15] & 0x07) | (regs[0x16] << 3)];
+    args.damping[lane] = resonance[regs[0x17] >> 4];
+    args.lpMask[lane] = (regs[0x18] & 0x10) ? ~0u : 0;
+    args.bpMask[lane] = (regs[0x18] & 0x20) ? ~0u : 0;
+    args.hpMask[lane] = (regs[0x18] & 0x40) ? ~0u : 0;
+    args.dc[lane] = mixerDC;
+    args.gain[lane] = (regs[0x18] & 0x0F) / 15.0f;
+    args.lp[lane] = lp;
+    args.bp[lane] = bp;
+}
+
+void SidChip::SetFilterState(const SidFilterArgs &args, int lane)
+{
+    lp = args.lp[lane];
+    bp = args.bp[lane];
+}
+
+SidRenderer::SidRenderer()
+{
+    clockHz = 985248;
+    sampleRate = 44100;
+    step = position = cycle = 0;
+    memset(sidAddr, 0, sizeof(sidAddr));
+    dcIn = dcOut = 0;
+}
+
+void SidRenderer::Begin(const SidLogHeader &header, uint32_t sample_rate)
+{
+    clockHz = header.clock_hz ? header.clock_hz : 985248;
+    sampleRate = sample_rate ? sample_rate : 44100;
+    chips.resize(header.sid_count);
+    for (int i = 0; i < header.sid_count; i++) {
+        chips[i].Reset(sidemu_model(header.chip_type[i]), sampleRate);
+        sidAddr[i] = header.sid_addr[i];
+    }
+    step = ((uint64_t)clockHz << 32) / sampleRate;
+    position = step;
+    cycle = 0;
+    dcIn = dcOut = 0;
+    samples.clear();
+}
+
+void SidRenderer::Write(const SidLogEntry &entry)
+{
+    RenderTo(entry.cycle);
+    if (entry.chip < chips.size()) chips[entry.chip].Write(entry.reg, entry.value);
+}
+
+void SidRenderer::Write(uint64_t cycle, uint16_t addr, uint8_t value)
+{
+    for (size_t chip = 0; chip < chips.size(); chip++) {
+        if ((uint16_t)(addr - sidAddr[chip]) < 0x20) {
+            RenderTo(cycle);
+            chips[chip].Write(addr & 0x1F, value);
+            return;
+        }
+    }
+}
+
+void SidRenderer::RenderTo(uint64_t until)
+{
+    if (chips.empty()) return;
+    /* headroom for three voices at full level with the 6581 offsets */
+    const float gain = 32767.0f / 4.0f / chips.size();
+    const float pole = 1.0f - 2.0f * (float)M_PI * 16.0f / sampleRate;  /* 16 Hz high pass */
+    const SidEmuKernels *k = sidemu_active();
+    while ((position >> 32) <= until) {
+        /* the samples up to until, splitting each in equal steps */
+        int count = 0;
+        uint32_t ends = 0;
+        for (; count < SIDEMU_BLOCK && (position >> 32) <= until; count++) {
+            uint32_t n = (position >> 32) - cycle;
+            block.cycles[count] = n;
+            for (int i = 0; i < SIDEMU_SUBSTEPS; i++) {
+                uint32_t c = n * (i + 1) / SIDEMU_SUBSTEPS - n * i / SIDEMU_SUBSTEPS;
+                ends += c;
+                block.stepCycles[count * SIDEMU_SUBSTEPS + i] = c;
+                block.ends[count * SIDEMU_SUBSTEPS + i] = ends;
+            }
+            cycle += n;
+            position += step;
+        }
+        block.samples = count;
+
+        SidFilterArgs args;
+        memset(&args, 0, sizeof(args));
+        for (size_t c = 0; c < chips.size(); c++) {
+            memset(filterSums[c], 0, count * sizeof(int32_t));
+            memset(directSums[c], 0, count * sizeof(int32_t));
+            chips[c].Render(block, filterSums[c], directSums[c]);
+            chips[c].GetFilter(args, c);
+        }
+        for (int s = 0; s < count; s++) {
+            for (int c = 0; c < SIDEMU_LANES; c++) {
+                bool used = c < (int)chips.size();
+                filterLanes[s * SIDEMU_LANES + c] = used ? filterSums[c][s] : 0;
+                directLanes[s * SIDEMU_LANES + c] = used ? directSums[c][s] : 0;
+            }
+        }
+        args.filter = filterLanes;
+        args.direct = directLanes;
+        args.cycles = block.cycles;
+        k->filter(args, count, mix);
+        for (size_t c = 0; c < chips.size(); c++) {
+            chips[c].SetFilterState(args, c);
+        }
+
+        for (int s = 0; s < count; s++) {
+            dcOut = mix[s] - dcIn + pole * dcOut;
+            dcIn = mix[s];
+            float out = dcOut * gain;
+            samples.push_back(out > 32767.0f ? 32767 : out < -32768.0f ? -32768 : (int16_t)lrintf(out));
+        }
+    }
+}
+
+const std::vector<int16_t> &SidRenderer::GetSamples()
+{
+    return samples;
+}
+
+void SidRenderer::ClearSamples()
+{
+    samples.clear();
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void wav_header(uint8_t *out, uint32_t sample_rate, uint64_t samples)
+{
+    uint32_t data = samples * 2 > 0xFFFFFFDBu ? 0xFFFFFFDBu : samples * 2;
+    memcpy(out, "RIFF", 4);
+    put32(out + 4, 36 + data);
+    memcpy(out + 8, "WAVEfmt ", 8);
+    put32(out + 16, 16);
+    put16(out + 20, 1);  /* PCM */
+    put16(out + 22, 1);  /* mono */
+    put32(out + 24, sample_rate);
+    put32(out + 28, sample_rate * 2);
+    put16(out + 32, 2);
+    put16(out + 34, 16);
+    memcpy(out + 36, "data", 4);
+    put32(out + 40, data);
+}
+
+WavWriter::WavWriter()
+{
+    file = NULL;
+    sampleRate = 44100;
+    samples = 0;
+    failed = false;
+}
+
+WavWriter::~WavWriter()
+{
+    Close();
+}
+
+bool WavWriter::Open(const std::string &path, uint32_t sample_rate)
+{
+    Close();
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) return false;
+    sampleRate = sample_rate;
+    samples = 0;
+    uint8_t header[44];
+    wav_header(header, sampleRate, 0);
+    failed = fwrite(header, sizeof(header), 1, file) != 1;
+    return true;
+}
+
+void WavWriter::Write(const int16_t *data, size_t count)
+{
+    if (file == NULL || count == 0) return;
+    uint8_t chunk[8192];
+    while (count) {
+        size_t n = count < sizeof(chunk) / 2 ? count : sizeof(chunk) / 2;
+        for (size_t i = 0; i < n; i++) {
+            put16(chunk + i * 2, data[i]);
+        }
+        if (fwrite(chunk, n * 2, 1, file) != 1)
+            failed = true;
+        data += n;
+        count -= n;
+        samples += n;
+    }
+}
+
+bool WavWriter::Close()
+{
+    if (file == NULL) return true;
+    uint8_t header[44];
+    wav_header(header, sampleRate, samples);
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(header), 1, file) != 1)
+        failed = true;
+    if (fclose(file) != 0)
+        failed = true;
+    file = NULL;
+    return !failed;
+}
+
+uint64_t WavWriter::GetSamples()
+{
+    return samples;
+}
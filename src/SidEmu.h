@@ -0,0 +1,148 @@
+//============================================================================
+// Description : Software SID for rendering without hardware
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// A compact 6581/8580 model, not cycle exact: writes take effect at
+// the sample boundary, the oscillators and envelopes run in
+// SIDEMU_SUBSTEPS steps per sample, the filter once per half sample.
+// The inner loops are the block kernels of SidEmuSimd.h. Modelled are
+// the 24 bit oscillators with sync, ring modulation and the 23 bit
+// noise LFSR, the envelope rate and exponential counters including
+// the ADSR delay bug, and a state variable filter with the cutoff
+// curve of each model. Combined waveforms are the AND of their parts.
+// The 6581 has its waveform and mixer DC offsets, so writes to the
+// volume register are heard (digis).
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SidEmuSimd.h"
+#include "SidLog.h"
+
+#define SIDEMU_6581 0
+#define SIDEMU_8580 1
+
+// Model for a SidFile::GetChipType value, 6581 unless it says 8580 only
+int sidemu_model(int chip_type);
+
+// The timing of a block of samples, the same for every chip
+struct SidBlock
+{
+    int samples;
+    uint16_t cycles[SIDEMU_BLOCK];  /* per sample */
+    uint16_t stepCycles[SIDEMU_BLOCK * SIDEMU_SUBSTEPS];
+    uint32_t ends[SIDEMU_BLOCK * SIDEMU_SUBSTEPS];  /* cycles from the block start to the end of each step */
+};
+
+class SidChip
+{
+private:
+    struct Voice
+    {
+        uint32_t acc;      /* 24 bit phase accumulator */
+        uint32_t noise;    /* 23 bit LFSR */
+        uint16_t freq;
+        uint16_t pw;
+        uint8_t control;
+        uint8_t attackDecay;
+        uint8_t sustainRelease;
+        /* envelope */
+        uint8_t state;
+        uint8_t level;
+        uint16_t rateCounter;  /* 15 bit, wraps when the period drops below it */
+        uint16_t ratePeriod;
+        uint8_t expCounter;
+    };
+    Voice voice[3];
+    int model;
+    uint8_t regs[32];
+    int waveZero;       /* waveform output at zero level */
+    float mixerDC;
+    float cutoff[2048]; /* filter coefficient per cutoff register value */
+    float resonance[16];/* damping, Q from 0.7 to about 2.2 */
+    float lp, bp;       /* filter state */
+    /* per step of a block */
+    uint32_t acc[3][SIDEMU_BLOCK * SIDEMU_SUBSTEPS];
+    uint32_t noise[3][SIDEMU_BLOCK * SIDEMU_SUBSTEPS];
+    int32_t weight[SIDEMU_BLOCK * SIDEMU_SUBSTEPS];
+
+    void SetRate(Voice &v);
+    void ClockEnvelope(Voice &v, uint32_t cycles);
+    void Step(uint32_t cycles);
+    void Oscillate(const SidBlock &block, const SidEmuKernels *k);
+    void OscillateSync(const SidBlock &block);
+
+public:
+    SidChip();
+    void Reset(int model, uint32_t sample_rate);
+    void Write(uint8_t reg, uint8_t value);
+    // clock the voices through a block, adding their output per sample
+    // to filter and direct; one voice at full level is 2048 * 255 per cycle
+    void Render(const SidBlock &block, int32_t *filter, int32_t *direct);
+    // advance the voices without output, for Read
+    void Clock(uint32_t cycles);
+    // OSC3 ($1B) and ENV3 ($1C), voice 3's waveform and envelope
+    uint8_t Read(uint8_t reg);
+    // correct voice 3 from OSC3 and ENV3 read on a real chip
+    void Resync(uint8_t osc3, uint8_t env3);
+    // this chip's filter and mixer as lane of the filter kernel
+    void GetFilter(SidFilterArgs &args, int lane);
+    void SetFilterState(const SidFilterArgs &args, int lane);
+};
+
+// Renders a stream of log entries to PCM at sample_rate
+class SidRenderer
+{
+private:
+    std::vector<SidChip> chips;
+    uint32_t clockHz;
+    uint32_t sampleRate;
+    uint64_t step;      /* cycles per sample, 32.32 fixed point */
+    uint64_t position;  /* next sample on the log clock, 32.32 */
+    uint64_t cycle;     /* log clock the chips are at, a sample boundary */
+    uint16_t sidAddr[SIDLOG_MAX_SIDS];
+    float dcIn, dcOut;  /* output coupling capacitor */
+    std::vector<int16_t> samples;
+    SidBlock block;
+    int32_t filterSums[SIDEMU_LANES][SIDEMU_BLOCK];
+    int32_t directSums[SIDEMU_LANES][SIDEMU_BLOCK];
+    int32_t filterLanes[SIDEMU_BLOCK * SIDEMU_LANES];
+    int32_t directLanes[SIDEMU_BLOCK * SIDEMU_LANES];
+    float mix[SIDEMU_BLOCK];
+
+public:
+    SidRenderer();
+    void Begin(const SidLogHeader &header, uint32_t sample_rate);
+    // render up to the entry's time, then apply the write
+    void Write(const SidLogEntry &entry);
+    // as Write, for a C64 address; ignored outside the SIDs of the header
+    void Write(uint64_t cycle, uint16_t addr, uint8_t value);
+    // render the samples up to cycle on the log clock
+    void RenderTo(uint64_t cycle);
+    // the samples rendered since the last ClearSamples
+    const std::vector<int16_t> &GetSamples();
+    void ClearSamples();
+};
+
+// 16 bit mono PCM WAV file
+class WavWriter
+{
+private:
+    FILE *file;
+    uint32_t sampleRate;
+    uint64_t samples;
+    bool failed;
+
+public:
+    WavWriter();
+    ~WavWriter();
+    bool Open(const std::string &path, uint32_t sample_rate);
+    void Write(const int16_t *data, size_t count);
+    bool Close();  /* patches the sizes into the header */
+    uint64_t GetSamples();
+};
@@ -0,0 +1,384 @@
+//============================================================================
+// Description : Block kernels of the software SID, scalar and SIMD
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "SidEmuSimd.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define SIDEMU_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIDEMU_ARM 1
+#include <arm_neon.h>
+#endif
+
+#define DENORMAL 1e-12f
+
+/* ---- scalar reference ---- */
+
+static void accumulate_scalar(uint32_t acc0, uint32_t freq, const uint32_t *ends, int steps, uint32_t *acc)
+{
+    for (int t = 0; t < steps; t++) {
+        acc[t] = (acc0 + freq * ends[t]) & 0xFFFFFF;
+    }
+}
+
+static inline uint32_t wave_step(const SidWaveArgs &a, int t, uint32_t tri, uint32_t saw, uint32_t pulse, uint32_t noise)
+{
+    uint32_t acc = a.acc[t];
+    uint32_t out = 0xFFF;
+    uint32_t msb = ((a.control & 0x04) ? acc ^ a.source[t] : acc) & 0x800000;
+    out &= (((msb ? ~acc : acc) >> 11) & 0xFFF) | ~tri;
+    out &= (acc >> 12) | ~saw;
+    out &= (((a.control & 0x08) || (acc >> 12) >= a.pw) ? 0xFFF : 0) | ~pulse;
+    if (noise) out &= a.noise[t];
+    return out;
+}
+
+static void wave_scalar(const SidWaveArgs &a, int samples, int32_t *sums)
+{
+    uint32_t waveform = a.control >> 4;
+    uint32_t tri = (waveform & 1) ? ~0u : 0;
+    uint32_t saw = (waveform & 2) ? ~0u : 0;
+    uint32_t pulse = (waveform & 4) ? ~0u : 0;
+    uint32_t noise = (waveform & 8) ? ~0u : 0;
+    for (int s = 0; s < samples; s++) {
+        int32_t sum = 0;
+        for (int i = 0; i < SIDEMU_SUBSTEPS; i++) {
+            int t = s * SIDEMU_SUBSTEPS + i;
+            int32_t out = waveform ? (int32_t)wave_step(a, t, tri, saw, pulse, noise) : 0;
+            sum += (out - a.zero) * a.weight[t];
+        }
+        sums[s] += sum;
+    }
+}
+
+static void filter_scalar(SidFilterArgs &f, int samples, float *out)
+{
+    const float scale = 1.0f / (2048.0f * 255.0f);
+    for (int s = 0; s < samples; s++) {
+        float n = f.cycles[s];
+        float mix = 0;
+        for (int l = 0; l < SIDEMU_LANES; l++) {
+            float in = (float)f.filter[s * SIDEMU_LANES + l] * scale / n;
+            float direct = (float)f.direct[s * SIDEMU_LANES + l] * scale / n;
+            float lp = f.lp[l], bp = f.bp[l], hp = 0;
+            for (int i = 0; i < 2; i++) {
+                hp = in - lp - f.damping[l] * bp;
+                bp = bp + f.w[l] * hp;
+                lp = lp + f.w[l] * bp;
+            }
+            /* denormals when it rings out are slow */
+            if (fabsf(lp) < DENORMAL) lp = 0;
+            if (fabsf(bp) < DENORMAL) bp = 0;
+            f.lp[l] = lp;
+            f.bp[l] = bp;
+            uint32_t bits[3];
+            float parts[3] = { lp, bp, hp };
+            memcpy(bits, parts, sizeof(bits));
+            bits[0] &= f.lpMask[l];
+            bits[1] &= f.bpMask[l];
+            bits[2] &= f.hpMask[l];
+            memcpy(parts, bits, sizeof(bits));
+            float filtered = parts[0] + parts[1] + parts[2];
+            mix = mix + (direct + filtered + f.dc[l]) * f.gain[l];
+        }
+        out[s] = mix;
+    }
+}
+
+static const SidEmuKernels kernels_scalar = { SIDEMU_SCALAR, "scalar", accumulate_scalar, wave_scalar, filter_scalar };
+
+/* ---- SSE4.1 and AVX2 ---- */
+
+#if defined(SIDEMU_X86)
+TARGET_SSE41 static void accumulate_sse41(uint32_t acc0, uint32_t freq, const uint32_t *ends, int steps, uint32_t *acc)
+{
+    __m128i base = _mm_set1_epi32(acc0);
+    __m128i f = _mm_set1_epi32(freq);
+    __m128i mask = _mm_set1_epi32(0xFFFFFF);
+    int t = 0;
+    for (; t + 4 <= steps; t += 4) {
+        __m128i e = _mm_loadu_si128((const __m128i *)(ends + t));
+        __m128i a = _mm_and_si128(_mm_add_epi32(base, _mm_mullo_epi32(f, e)), mask);
+        _mm_storeu_si128((__m128i *)(acc + t), a);
+    }
+    accumulate_scalar(acc0, freq, ends + t, steps - t, acc + t);
+}
+
+/* the waveform of four steps */
+TARGET_SSE41 static inline __m128i wave4_sse41(const SidWaveArgs &a, int t, __m128i tri, __m128i saw, __m128i pulse,
+                                               __m128i noise, __m128i pw, __m128i test)
+{
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i m12 = _mm_set1_epi32(0xFFF);
+    __m128i acc = _mm_loadu_si128((const __m128i *)(a.acc + t));
+    __m128i ring = (a.control & 0x04) ? _mm_xor_si128(acc, _mm_loadu_si128((const __m128i *)(a.source + t))) : acc;
+    __m128i msb = _mm_cmpeq_epi32(_mm_and_si128(ring, _mm_set1_epi32(0x800000)), _mm_setzero_si128());  /* ones if clear */
+    __m128i folded = _mm_blendv_epi8(_mm_xor_si128(acc, ones), acc, msb);
+    __m128i out = _mm_and_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(folded, 11), m12), _mm_andnot_si128(tri, ones)), m12);
+    __m128i top = _mm_srli_epi32(acc, 12);
+    out = _mm_and_si128(out, _mm_or_si128(top, _mm_andnot_si128(saw, ones)));
+    /* top >= pw, both below 2^12 so a signed compare does */
+    __m128i high = _mm_or_si128(_mm_xor_si128(_mm_cmpgt_epi32(pw, top), ones), test);
+    out = _mm_and_si128(out, _mm_or_si128(_mm_and_si128(high, m12), _mm_andnot_si128(pulse, ones)));
+    if (a.noise) out = _mm_and_si128(out, _mm_or_si128(_mm_loadu_si128((const __m128i *)(a.noise + t)), _mm_andnot_si128(noise, ones)));
+    return out;
+}
+
+TARGET_SSE41 static void wave_sse41(const SidWaveArgs &a, int samples, int32_t *sums)
+{
+    uint32_t waveform = a.control >> 4;
+    if (waveform == 0) {
+        wave_scalar(a, samples, sums);
+        return;
+    }
+    __m128i tri = _mm_set1_epi32((waveform & 1) ? -1 : 0);
+    __m128i saw = _mm_set1_epi32((waveform & 2) ? -1 : 0);
+    __m128i pulse = _mm_set1_epi32((waveform & 4) ? -1 : 0);
+    __m128i noise = _mm_set1_epi32((waveform & 8) ? -1 : 0);
+    __m128i pw = _mm_set1_epi32(a.pw);
+    __m128i test = _mm_set1_epi32((a.control & 0x08) ? -1 : 0);
+    __m128i zero = _mm_set1_epi32(a.zero);
+    for (int s = 0; s < samples; s++) {  /* one sample is four steps */
+        int t = s * SIDEMU_SUBSTEPS;
+        __m128i out = wave4_sse41(a, t, tri, saw, pulse, noise, pw, test);
+        __m128i v = _mm_mullo_epi32(_mm_sub_epi32(out, zero), _mm_loadu_si128((const __m128i *)(a.weight + t)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        sums[s] += _mm_cvtsi128_si32(v);
+    }
+}
+
+TARGET_SSE41 static void filter_sse41(SidFilterArgs &f, int samples, float *out)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / (2048.0f * 255.0f));
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 tiny = _mm_set1_ps(DENORMAL);
+    __m128 w = _mm_loadu_ps(f.w), damping = _mm_loadu_ps(f.damping);
+    __m128 lpMask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)f.lpMask));
+    __m128 bpMask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)f.bpMask));
+    __m128 hpMask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)f.hpMask));
+    __m128 dc = _mm_loadu_ps(f.dc), gain = _mm_loadu_ps(f.gain);
+    __m128 lp = _mm_loadu_ps(f.lp), bp = _mm_loadu_ps(f.bp), hp = _mm_setzero_ps();
+    for (int s = 0; s < samples; s++) {
+        __m128 n = _mm_set1_ps((float)f.cycles[s]);
+        __m128 in = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(f.filter + s * SIDEMU_LANES))), scale), n);
+        __m128 direct = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(f.direct + s * SIDEMU_LANES))), scale), n);
+        for (int i = 0; i < 2; i++) {
+            hp = _mm_sub_ps(_mm_sub_ps(in, lp), _mm_mul_ps(damping, bp));
+            bp = _mm_add_ps(bp, _mm_mul_ps(w, hp));
+            lp = _mm_add_ps(lp, _mm_mul_ps(w, bp));
+        }
+        lp = _mm_andnot_ps(_mm_cmplt_ps(_mm_andnot_ps(sign, lp), tiny), lp);
+        bp = _mm_andnot_ps(_mm_cmplt_ps(_mm_andnot_ps(sign, bp), tiny), bp);
+        __m128 filtered = _mm_add_ps(_mm_add_ps(_mm_and_ps(lp, lpMask), _mm_and_ps(bp, bpMask)), _mm_and_ps(hp, hpMask));
+        __m128 lanes = _mm_mul_ps(_mm_add_ps(_mm_add_ps(direct, filtered), dc), gain);
+        float l[SIDEMU_LANES];
+        _mm_storeu_ps(l, lanes);
+        out[s] = ((0.0f + l[0]) + l[1] + l[2]) + l[3];  /* the order of the reference */
+    }
+    _mm_storeu_ps(f.lp, lp);
+    _mm_storeu_ps(f.bp, bp);
+}
+
+static const SidEmuKernels kernels_sse41 = { SIDEMU_SSE41, "sse4.1", accumulate_sse41, wave_sse41, filter_sse41 };
+
+TARGET_AVX2 static void accumulate_avx2(uint32_t acc0, uint32_t freq, const uint32_t *ends, int steps, uint32_t *acc)
+{
+    __m256i base = _mm256_set1_epi32(acc0);
+    __m256i f = _mm256_set1_epi32(freq);
+    __m256i mask = _mm256_set1_epi32(0xFFFFFF);
+    int t = 0;
+    for (; t + 8 <= steps; t += 8) {
+        __m256i e = _mm256_loadu_si256((const __m256i *)(ends + t));
+        __m256i a = _mm256_and_si256(_mm256_add_epi32(base, _mm256_mullo_epi32(f, e)), mask);
+        _mm256_storeu_si256((__m256i *)(acc + t), a);
+    }
+    accumulate_scalar(acc0, freq, ends + t, steps - t, acc + t);
+}
+
+/* two samples per vector */
+TARGET_AVX2 static void wave_avx2(const SidWaveArgs &a, int samples, int32_t *sums)
+{
+    uint32_t waveform = a.control >> 4;
+    if (waveform == 0 || (samples & 1)) {
+        wave_sse41(a, samples, sums);
+        return;
+    }
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i m12 = _mm256_set1_epi32(0xFFF);
+    __m256i tri = _mm256_set1_epi32((waveform & 1) ? -1 : 0);
+    __m256i saw = _mm256_set1_epi32((waveform & 2) ? -1 : 0);
+    __m256i pulse = _mm256_set1_epi32((waveform & 4) ? -1 : 0);
+    __m256i noise = _mm256_set1_epi32((waveform & 8) ? -1 : 0);
+    __m256i pw = _mm256_set1_epi32(a.pw);
+    __m256i test = _mm256_set1_epi32((a.control & 0x08) ? -1 : 0);
+    __m256i zero = _mm256_set1_epi32(a.zero);
+    for (int s = 0; s < samples; s += 2) {
+        int t = s * SIDEMU_SUBSTEPS;
+        __m256i acc = _mm256_loadu_si256((const __m256i *)(a.acc + t));
+        __m256i ring = (a.control & 0x04) ? _mm256_xor_si256(acc, _mm256_loadu_si256((const __m256i *)(a.source + t))) : acc;
+        __m256i msb = _mm256_cmpeq_epi32(_mm256_and_si256(ring, _mm256_set1_epi32(0x800000)), _mm256_setzero_si256());
+        __m256i folded = _mm256_blendv_epi8(_mm256_xor_si256(acc, ones), acc, msb);
+        __m256i out = _mm256_and_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(folded, 11), m12), _mm256_andnot_si256(tri, ones)), m12);
+        __m256i top = _mm256_srli_epi32(acc, 12);
+        out = _mm256_and_si256(out, _mm256_or_si256(top, _mm256_andnot_si256(saw, ones)));
+        __m256i high = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpgt_epi32(pw, top), ones), test);
+        out = _mm256_and_si256(out, _mm256_or_si256(_mm256_and_si256(high, m12), _mm256_andnot_si256(pulse, ones)));
+        if (a.noise) out = _mm256_and_si256(out, _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(a.noise + t)), _mm256_andnot_si256(noise, ones)));
+        __m256i v = _mm256_mullo_epi32(_mm256_sub_epi32(out, zero), _mm256_loadu_si256((const __m256i *)(a.weight + t)));
+        v = _mm256_add_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm256_add_epi32(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        sums[s] += _mm256_extract_epi32(v, 0);
+        sums[s + 1] += _mm256_extract_epi32(v, 4);
+    }
+}
+
+/* four lanes fill one SSE vector, the filter has nothing for AVX2 */
+static const SidEmuKernels kernels_avx2 = { SIDEMU_AVX2, "avx2", accumulate_avx2, wave_avx2, filter_sse41 };
+#endif
+
+/* ---- NEON ---- */
+
+#if defined(SIDEMU_ARM)
+static void accumulate_neon(uint32_t acc0, uint32_t freq, const uint32_t *ends, int steps, uint32_t *acc)
+{
+    uint32x4_t base = vdupq_n_u32(acc0);
+    uint32x4_t mask = vdupq_n_u32(0xFFFFFF);
+    int t = 0;
+    for (; t + 4 <= steps; t += 4) {
+        uint32x4_t a = vandq_u32(vmlaq_n_u32(base, vld1q_u32(ends + t), freq), mask);
+        vst1q_u32(acc + t, a);
+    }
+    accumulate_scalar(acc0, freq, ends + t, steps - t, acc + t);
+}
+
+static void wave_neon(const SidWaveArgs &a, int samples, int32_t *sums)
+{
+    uint32_t waveform = a.control >> 4;
+    if (waveform == 0) {
+        wave_scalar(a, samples, sums);
+        return;
+    }
+    const uint32x4_t m12 = vdupq_n_u32(0xFFF);
+    uint32x4_t tri = vdupq_n_u32((waveform & 1) ? 0 : ~0u);  /* inverted selects */
+    uint32x4_t saw = vdupq_n_u32((waveform & 2) ? 0 : ~0u);
+    uint32x4_t pulse = vdupq_n_u32((waveform & 4) ? 0 : ~0u);
+    uint32x4_t noise = vdupq_n_u32((waveform & 8) ? 0 : ~0u);
+    uint32x4_t pw = vdupq_n_u32(a.pw);
+    uint32x4_t test = vdupq_n_u32((a.control & 0x08) ? ~0u : 0);
+    int32x4_t zero = vdupq_n_s32(a.zero);
+    for (int s = 0; s < samples; s++) {
+        int t = s * SIDEMU_SUBSTEPS;
+        uint32x4_t acc = vld1q_u32(a.acc + t);
+        uint32x4_t ring = (a.control & 0x04) ? veorq_u32(acc, vld1q_u32(a.source + t)) : acc;
+        uint32x4_t set = vtstq_u32(ring, vdupq_n_u32(0x800000));
+        uint32x4_t folded = vbslq_u32(set, vmvnq_u32(acc), acc);
+        uint32x4_t out = vandq_u32(vorrq_u32(vandq_u32(vshrq_n_u32(folded, 11), m12), tri), m12);
+        uint32x4_t top = vshrq_n_u32(acc, 12);
+        out = vandq_u32(out, vorrq_u32(top, saw));
+        uint32x4_t high = vorrq_u32(vcgeq_u32(top, pw), test);
+        out = vandq_u32(out, vorrq_u32(vandq_u32(high, m12), pulse));
+        if (a.noise) out = vandq_u32(out, vorrq_u32(vld1q_u32(a.noise + t), noise));
+        int32x4_t v = vmulq_s32(vsubq_s32(vreinterpretq_s32_u32(out), zero), vld1q_s32(a.weight + t));
+        sums[s] += vaddvq_s32(v);
+    }
+}
+
+static void filter_neon(SidFilterArgs &f, int samples, float *out)
+{
+    const float32x4_t scale = vdupq_n_f32(1.0f / (2048.0f * 255.0f));
+    const float32x4_t tiny = vdupq_n_f32(DENORMAL);
+    float32x4_t w = vld1q_f32(f.w), damping = vld1q_f32(f.damping);
+    uint32x4_t lpMask = vld1q_u32(f.lpMask), bpMask = vld1q_u32(f.bpMask), hpMask = vld1q_u32(f.hpMask);
+    float32x4_t dc = vld1q_f32(f.dc), gain = vld1q_f32(f.gain);
+    float32x4_t lp = vld1q_f32(f.lp), bp = vld1q_f32(f.bp), hp = vdupq_n_f32(0);
+    for (int s = 0; s < samples; s++) {
+        float32x4_t n = vdupq_n_f32((float)f.cycles[s]);
+        float32x4_t in = vdivq_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(f.filter + s * SIDEMU_LANES)), scale), n);
+        float32x4_t direct = vdivq_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(f.direct + s * SIDEMU_LANES)), scale), n);
+        for (int i = 0; i < 2; i++) {
+            hp = vsubq_f32(vsubq_f32(in, lp), vmulq_f32(damping, bp));
+            bp = vaddq_f32(bp, vmulq_f32(w, hp));
+            lp = vaddq_f32(lp, vmulq_f32(w, bp));
+        }
+        lp = vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(lp), vcltq_f32(vabsq_f32(lp), tiny)));
+        bp = vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(bp), vcltq_f32(vabsq_f32(bp), tiny)));
+        float32x4_t filtered = vaddq_f32(vaddq_f32(vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(lp), lpMask)),
+                                                   vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(bp), bpMask))),
+                                         vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(hp), hpMask)));
+        float32x4_t lanes = vmulq_f32(vaddq_f32(vaddq_f32(direct, filtered), dc), gain);
+        float l[SIDEMU_LANES];
+        vst1q_f32(l, lanes);
+        out[s] = ((0.0f + l[0]) + l[1] + l[2]) + l[3];
+    }
+    vst1q_f32(f.lp, lp);
+    vst1q_f32(f.bp, bp);
+}
+
+static const SidEmuKernels kernels_neon = { SIDEMU_NEON, "neon", accumulate_neon, wave_neon, filter_neon };
+#endif
+
+/* ---- dispatch ---- */
+
+const SidEmuKernels *sidemu_kernels(int isa)
+{
+    switch (isa) {
+    case SIDEMU_SCALAR:
+        return &kernels_scalar;
+#if defined(SIDEMU_X86) && (defined(__GNUC__) || defined(__clang__))
+    case SIDEMU_SSE41:
+        return __builtin_cpu_supports("sse4.1") ? &kernels_sse41 : nullptr;
+    case SIDEMU_AVX2:
+        return __builtin_cpu_supports("avx2") ? &kernels_avx2 : nullptr;
+#endif
+#if defined(SIDEMU_ARM)
+    case SIDEMU_NEON:
+        return &kernels_neon;
+#endif
+    }
+    return nullptr;
+}
+
+static const SidEmuKernels *best_kernels()
+{
+    const int order[] = { SIDEMU_AVX2, SIDEMU_NEON, SIDEMU_SSE41, SIDEMU_SCALAR };
+    for (int isa : order) {
+        const SidEmuKernels *k = sidemu_kernels(isa);
+        if (k) return k;
+    }
+    return &kernels_scalar;
+}
+
+/* set by the tests only, before they render */
+static std::atomic<const SidEmuKernels *> forced_kernels(nullptr);
+
+const SidEmuKernels *sidemu_active()
+{
+    static const SidEmuKernels *best = best_kernels();  /* thread safe, the batch renders from a pool */
+    const SidEmuKernels *k = forced_kernels.load(std::memory_order_relaxed);
+    return k ? k : best;
+}
+
+bool sidemu_set_isa(int isa)
+{
+    const SidEmuKernels *k = sidemu_kernels(isa);
+    if (k == nullptr) return false;
+    forced_kernels.store(k, std::memory_order_relaxed);
+    return true;
+}
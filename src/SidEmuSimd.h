@@ -0,0 +1,74 @@
+//============================================================================
+// Description : Block kernels of the software SID, scalar and SIMD
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// The inner loops of SidChip and SidRenderer over a block of samples,
+// each sample split in SIDEMU_SUBSTEPS oscillator steps. Every kernel
+// has a scalar reference; the SSE4.1, AVX2 and NEON versions give the
+// same bits (tests/sidemu_test.cpp checks this). Floating point kernels
+// only do the operations of the reference in the same order, so build
+// SidEmuSimd.cpp without contracting them into FMA (-ffp-contract=off).
+
+#pragma once
+#include <cstdint>
+
+#define SIDEMU_SUBSTEPS  4    // oscillator steps per sample
+#define SIDEMU_BLOCK     256  // samples per block at most
+#define SIDEMU_LANES     4    // chips the filter runs side by side
+
+#define SIDEMU_SCALAR 0
+#define SIDEMU_SSE41  1
+#define SIDEMU_AVX2   2
+#define SIDEMU_NEON   3
+
+// One voice over a block
+struct SidWaveArgs
+{
+    const uint32_t *acc;     // accumulator after every step
+    const uint32_t *source;  // of the voice ring modulating this one
+    const uint32_t *noise;   // noise waveform output per step when it is selected
+    const int32_t *weight;   // envelope level times the step's cycles
+    uint32_t control;
+    uint32_t pw;
+    int32_t zero;            // waveform output at zero level
+};
+
+// The filters and mixers of up to SIDEMU_LANES chips over a block.
+// Per sample and lane the voice sums into and around the filter; lanes
+// without a chip have zero parameters.
+struct SidFilterArgs
+{
+    const int32_t *filter;   // [sample * SIDEMU_LANES + lane]
+    const int32_t *direct;
+    const uint16_t *cycles;  // cycles of each sample
+    float w[SIDEMU_LANES];   // cutoff coefficient
+    float damping[SIDEMU_LANES];
+    uint32_t lpMask[SIDEMU_LANES];  // all ones when the mode is on
+    uint32_t bpMask[SIDEMU_LANES];
+    uint32_t hpMask[SIDEMU_LANES];
+    float dc[SIDEMU_LANES];  // mixer DC offset
+    float gain[SIDEMU_LANES];  // volume
+    float lp[SIDEMU_LANES];  // filter state, updated
+    float bp[SIDEMU_LANES];
+};
+
+struct SidEmuKernels
+{
+    int isa;
+    const char *name;
+    // acc[t] = (acc0 + freq * ends[t]) & 0xFFFFFF
+    void (*accumulate)(uint32_t acc0, uint32_t freq, const uint32_t *ends, int steps, uint32_t *acc);
+    // sums[s] += the weighted waveform output of the steps of sample s
+    void (*wave)(const SidWaveArgs &args, int samples, int32_t *sums);
+    // out[s] = mix of all lanes, state in args advances
+    void (*filter)(SidFilterArgs &args, int samples, float *out);
+};
+
+// The kernels of an instruction set, nullptr if this build or CPU lacks it
+const SidEmuKernels *sidemu_kernels(int isa);
+// The kernels in use, the best the CPU has unless sidemu_set_isa was called
+const SidEmuKernels *sidemu_active();
+// For the tests: use the kernels of isa from now on, set before rendering
+bool sidemu_set_isa(int isa);
@@ -4,6 +4,7 @@
 // Last update : 2024
 //============================================================================
 
+#pragma once
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -0,0 +1,496 @@
+//============================================================================
+// Description : Binary log of SID writes
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cstring>
+#if defined(UNIX_COMPILE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SidLog.h"
+#include "SidPack.h"
+#include "SongLength.h"
+
+static const char sidlog_magic[8] = { 'S', 'I', 'D', 'B', 'L', 'O', 'G', 0 };
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    put32(p, v);
+    put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void put_text(char *out, const std::string &text)
+{
+    memset(out, 0, 32);
+    strncpy(out, text.c_str(), 31);
+}
+
+void sidlog_header(SidLogHeader &header, SidFile &sid, int song_number, uint32_t clock_hz, uint32_t frame_us)
+{
+    memset(&header, 0, sizeof(header));
+    header.clock_hz = clock_hz;
+    header.frame_us = frame_us;
+    int sv = sid.GetSidVersion();
+    header.sid_count = (sv == 3 ? 2 : sv == 4 ? 3 : sv == 78 ? 4 : 1);
+    header.song = song_number;
+    header.songs = sid.GetNumOfSongs();
+    header.sid_addr[0] = 0xD400;
+    header.chip_type[0] = sid.GetChipType(1);
+    for (int i = 1; i < header.sid_count; i++) {
+        header.sid_addr[i] = 0xD000 | (sid.GetSIDaddr(i + 1) << 4);
+        header.chip_type[i] = sid.GetChipType(i < 3 ? i + 1 : 3);
+    }
+    header.sid_hash = sid_hash(sid);
+    put_text(header.name, sid.GetModuleName());
+    put_text(header.author, sid.GetAuthorName());
+    put_text(header.released, sid.GetCopyrightInfo());
+}
+
+// 0 magic, 8 version, 10 header size, 12 clock, 16 frame time,
+// 20 SID count, 21 song, 22 songs, 23 reserved, 24 chip types,
+// 28 SID addresses, 36 tune hash, 44 entries, 52 cycles,
+// 60 name, 92 author, 124 released, 156 reserved
+void sidlog_encode_header(const SidLogHeader &header, uint8_t *out)
+{
+    memset(out, 0, SIDLOG_HEADER_SIZE);
+    memcpy(out, sidlog_magic, 8);
+    put16(out + 8, SIDLOG_VERSION);
+    put16(out + 10, SIDLOG_HEADER_SIZE);
+    put32(out + 12, header.clock_hz);
+    put32(out + 16, header.frame_us);
+    out[20] = header.sid_count;
+    out[21] = header.song;
+    out[22] = header.songs;
+    for (int i = 0; i < SIDLOG_MAX_SIDS; i++) {
+        out[24 + i] = header.chip_type[i];
+        put16(out + 28 + i * 2, header.sid_addr[i]);
+    }
+    put64(out + 36, header.sid_hash);
+    put64(out + 44, header.entries);
+    put64(out + 52, header.cycles);
+    memcpy(out + 60, header.name, 32);
+    memcpy(out + 92, header.author, 32);
+    memcpy(out + 124, header.released, 32);
+}
+
+bool sidlog_decode_header(const uint8_t *in, size_t size, SidLogHeader &header)
+{
+    if (size < SIDLOG_HEADER_SIZE || memcmp(in, sidlog_magic, 8) != 0) return false;
+    if (get16(in + 8) != SIDLOG_VERSION || get16(in + 10) != SIDLOG_HEADER_SIZE) return false;
+    memset(&header, 0, sizeof(header));
+    header.clock_hz = get32(in + 12);
+    header.frame_us = get32(in + 16);
+    header.sid_count = in[20];
+    header.song = in[21];
+    header.songs = in[22];
+    if (header.sid_count < 1 || header.sid_count > SIDLOG_MAX_SIDS) return false;
+    for (int i = 0; i < SIDLOG_MAX_SIDS; i++) {
+        header.chip_type[i] = in[24 + i];
+        header.sid_addr[i] = get16(in + 28 + i * 2);
+    }
+    header.sid_hash = get64(in + 36);
+    header.entries = get64(in + 44);
+    header.cycles = get64(in + 52);
+    memcpy(header.name, in + 60, 32);
+    memcpy(header.author, in + 92, 32);
+    memcpy(header.released, in + 124, 32);
+    header.name[31] = header.author[31] = header.released[31] = 0;
+    return true;
+}
+
+SidLogWriter::SidLogWriter()
+{
+    current = nullptr;
+    blockSize = 0;
+    closing = false;
+    failed = false;
+    file = NULL;
+    format = SIDLOG_RAW;
+    packClock = 0;
+    memset(&header, 0, sizeof(header));
+    clock = frameBase = frameStart = frames = 0;
+    entries = extraBlocks = 0;
+}
+
+SidLogWriter::~SidLogWriter()
+{
+    Close();
+}
+
+void SidLogWriter::SetFormat(int format)
+{
+    this->format = format;
+}
+
+bool SidLogWriter::Open(const std::string &path, const SidLogHeader &h, uint64_t cpu_cycles,
+                        size_t block_size, int block_count)
+{
+    Close();
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) return false;
+
+    header = h;
+    header.entries = 0;
+    header.cycles = 0;
+    if (header.frame_us == 0) header.frame_us = 20000;
+    if (format == SIDLOG_RAW) {
+        pack.reset();
+        uint8_t raw[SIDLOG_HEADER_SIZE];
+        sidlog_encode_header(header, raw);
+        failed = fwrite(raw, SIDLOG_HEADER_SIZE, 1, file) != 1;
+    } else {
+        pack.reset(new SidPackEncoder);
+        failed = !pack->Begin(file, header, format == SIDLOG_PACK_ENTROPY);
+        packClock = 0;
+    }
+
+    blockSize = block_size - (block_size % SIDLOG_ENTRY_SIZE);
+    blocks.clear();
+    spare.clear();
+    full.clear();
+    for (int i = 0; i < block_count; i++) {
+        blocks.emplace_back(new Block{ std::unique_ptr<uint8_t[]>(new uint8_t[blockSize]), 0 });
+        spare.push_back(blocks.back().get());
+    }
+    current = spare.back();
+    spare.pop_back();
+
+    clock = frameBase = frames = 0;
+    frameStart = cpu_cycles;
+    entries = extraBlocks = 0;
+    closing = false;
+    flusher = std::thread(&SidLogWriter::Flusher, this);
+    return true;
+}
+
+bool SidLogWriter::Close()
+{
+    if (file == NULL) return true;
+    if (current->used) {
+        Swap();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    wake.notify_one();
+    flusher.join();
+
+    header.entries = entries;
+    header.cycles = clock;
+    if (pack) {
+        if (!pack->Finish(header))
+            failed = true;
+    } else {
+        uint8_t raw[SIDLOG_HEADER_SIZE];
+        sidlog_encode_header(header, raw);
+        if (fseek(file, 0, SEEK_SET) != 0 || fwrite(raw, SIDLOG_HEADER_SIZE, 1, file) != 1)
+            failed = true;
+    }
+    if (fclose(file) != 0)
+        failed = true;
+    file = NULL;
+    current = nullptr;
+    blocks.clear();
+    spare.clear();
+    return !failed;
+}
+
+bool SidLogWriter::IsOpen()
+{
+    return file != NULL;
+}
+
+void SidLogWriter::BeginFrame(uint64_t cpu_cycles)
+{
+    frameBase = frames * header.clock_hz * header.frame_us / 1000000;
+    frameStart = cpu_cycles;
+    frames++;
+}
+
+void SidLogWriter::Write(uint64_t cpu_cycles, uint16_t addr, uint8_t value)
+{
+    int chip = 0;
+    while (chip < header.sid_count && (uint16_t)(addr - header.sid_addr[chip]) >= 0x20) {
+        chip++;
+    }
+    if (chip == header.sid_count) return;
+
+    /* a play call running into the next frame keeps the order of writes */
+    uint64_t t = frameBase + (cpu_cycles > frameStart ? cpu_cycles - frameStart : 0);
+    Emit(t, (chip << 5) | (addr & 0x1F), value);
+}
+
+void SidLogWriter::Append(const SidLogEntry &entry)
+{
+    if (entry.chip >= header.sid_count) return;
+    Emit(entry.cycle, (entry.chip << 5) | (entry.reg & 0x1F), entry.value);
+}
+
+void SidLogWriter::Emit(uint64_t t, uint8_t reg, uint8_t value)
+{
+    if (t < clock) t = clock;
+    uint64_t delta = t - clock;
+    while (delta > SIDLOG_MAX_DELTA) {
+        Put(SIDLOG_MAX_DELTA, SIDLOG_WAIT, 0);
+        delta -= SIDLOG_MAX_DELTA;
+    }
+    Put(delta, reg, value);
+    clock = t;
+}
+
+void SidLogWriter::Put(uint16_t delta, uint8_t reg, uint8_t value)
+{
+    if (current->used == blockSize) {
+        Swap();
+    }
+    uint8_t *p = current->data.get() + current->used;
+    p[0] = delta;
+    p[1] = delta >> 8;
+    p[2] = reg;
+    p[3] = value;
+    current->used += SIDLOG_ENTRY_SIZE;
+    entries++;
+}
+
+void SidLogWriter::Swap()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        full.push_back(current);
+        if (!spare.empty()) {
+            current = spare.back();
+            spare.pop_back();
+        } else {
+            current = nullptr;
+        }
+    }
+    wake.notify_one();
+    if (current == nullptr) {
+        blocks.emplace_back(new Block{ std::unique_ptr<uint8_t[]>(new uint8_t[blockSize]), 0 });
+        std::lock_guard<std::mutex> guard(lock);
+        current = blocks.back().get();
+        extraBlocks++;
+    }
+    current->used = 0;
+}
+
+void SidLogWriter::Flusher()
+{
+    for (;;) {
+        Block *block;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return closing || !full.empty(); });
+            if (full.empty()) return;  /* closing and all written */
+            block = full.front();
+            full.pop_front();
+        }
+        if (pack) {
+            const uint8_t *p = block->data.get();
+            for (size_t i = 0; i < block->used; i += SIDLOG_ENTRY_SIZE, p += SIDLOG_ENTRY_SIZE) {
+                packClock += p[0] | (p[1] << 8);
+                if (p[2] == SIDLOG_WAIT) continue;
+                SidLogEntry entry = { packClock, (uint8_t)(p[2] >> 5), (uint8_t)(p[2] & 0x1F), p[3] };
+                pack->Add(entry);
+            }
+        } else if (fwrite(block->data.get(), block->used, 1, file) != 1) {
+            failed = true;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        spare.push_back(block);
+    }
+}
+
+uint64_t SidLogWriter::GetEntries()
+{
+    return entries;
+}
+
+uint64_t SidLogWriter::GetCycles()
+{
+    return clock;
+}
+
+uint64_t SidLogWriter::GetExtraBlocks()
+{
+    return extraBlocks;
+}
+
+SidLogReader::SidLogReader()
+{
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    memset(&header, 0, sizeof(header));
+    position = 0;
+    clock = 0;
+    memset(regs, 0, sizeof(regs));
+}
+
+SidLogReader::~SidLogReader()
+{
+    Close();
+}
+
+bool SidLogReader::Open(const std::string &path)
+{
+    Close();
+#if defined(UNIX_COMPILE)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            data = (const uint8_t *)p;
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (!mapped) return false;
+#else
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL) return false;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buffer.resize(length > 0 ? length : 0);
+    bool read = length > 0 && fread(buffer.data(), length, 1, f) == 1;
+    fclose(f);
+    if (!read) return false;
+    data = buffer.data();
+    size = buffer.size();
+#endif
+    if (SidPackReader::IsPack(data, size)) {
+        pack.reset(new SidPackReader);
+        if (!pack->Open(data, size, header)) {
+            Close();
+            return false;
+        }
+    } else if (!sidlog_decode_header(data, size, header)) {
+        Close();
+        return false;
+    }
+    Rewind();
+    return true;
+}
+
+void SidLogReader::Close()
+{
+#if defined(UNIX_COMPILE)
+    if (mapped) munmap((void *)data, size);
+#endif
+    mapped = false;
+    pack.reset();
+    buffer.clear();
+    data = nullptr;
+    size = 0;
+}
+
+const SidLogHeader &SidLogReader::GetHeader()
+{
+    return header;
+}
+
+bool SidLogReader::Next(SidLogEntry &entry)
+{
+    if (pack) return pack->Next(entry);
+    while (position + SIDLOG_ENTRY_SIZE <= size) {
+        const uint8_t *p = data + position;
+        position += SIDLOG_ENTRY_SIZE;
+        clock += p[0] | (p[1] << 8);
+        if (p[2] == SIDLOG_WAIT) continue;
+        entry.cycle = clock;
+        entry.chip = p[2] >> 5;
+        entry.reg = p[2] & 0x1F;
+        entry.value = p[3];
+        regs[p[2] & 0x7F] = p[3];
+        return true;
+    }
+    return false;
+}
+
+void SidLogReader::Rewind()
+{
+    if (pack) {
+        pack->Rewind();
+        return;
+    }
+    position = SIDLOG_HEADER_SIZE;
+    clock = 0;
+    memset(regs, 0, sizeof(regs));
+}
+
+void SidLogReader::Seek(uint64_t cycle)
+{
+    if (pack) {
+        pack->Seek(cycle);
+        return;
+    }
+    /* raw logs have no index, replay the register file up to cycle */
+    Rewind();
+    while (position + SIDLOG_ENTRY_SIZE <= size) {
+        const uint8_t *p = data + position;
+        uint64_t t = clock + (p[0] | (p[1] << 8));
+        if (p[2] != SIDLOG_WAIT) {
+            if (t >= cycle) return;
+            regs[p[2] & 0x7F] = p[3];
+        }
+        position += SIDLOG_ENTRY_SIZE;
+        clock = t;
+    }
+}
+
+void SidLogReader::GetRegisters(uint8_t *registers)
+{
+    if (pack) {
+        pack->GetRegisters(registers);
+        return;
+    }
+    memcpy(registers, regs, sizeof(regs));
+}
+
+bool SidLogReader::IsPacked()
+{
+    return pack != nullptr;
+}
+
+size_t SidLogReader::GetFileSize()
+{
+    return size;
+}
@@ -0,0 +1,166 @@
+//============================================================================
+// Description : Binary log of SID writes
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// File layout, all numbers little endian:
+//   header, SIDLOG_HEADER_SIZE bytes (see sidlog_encode_header)
+//   entries, SIDLOG_ENTRY_SIZE bytes each:
+//     uint16 cycles since the previous entry
+//     uint8  chip << 5 | register, or SIDLOG_WAIT for a clock-only entry
+//     uint8  value
+// Cycles run on the tune's clock from the start of the recording; the
+// player's frames are frame_us apart, also while the CPU is idle.
+// A log can also be written and read as a packed container, see SidPack.h.
+
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SidFile.h"
+
+#define SIDLOG_VERSION     1
+#define SIDLOG_HEADER_SIZE 160
+#define SIDLOG_ENTRY_SIZE  4
+#define SIDLOG_WAIT        0xFF    // advances the clock by the delta only
+#define SIDLOG_MAX_DELTA   0xFFFF
+#define SIDLOG_MAX_SIDS    4
+
+#define SIDLOG_RAW          0
+#define SIDLOG_PACK         1  // SidPack container, token bytes stored
+#define SIDLOG_PACK_ENTROPY 2  // SidPack container, token bytes range coded
+
+struct SidLogHeader
+{
+    uint32_t clock_hz;
+    uint32_t frame_us;     // time between play calls
+    uint8_t sid_count;
+    uint8_t song;          // from 0
+    uint8_t songs;
+    uint8_t chip_type[SIDLOG_MAX_SIDS];  // as SidFile::GetChipType
+    uint16_t sid_addr[SIDLOG_MAX_SIDS];  // chip n is at sid_addr[n]
+    uint64_t sid_hash;     // as sid_hash() in SongLength.h
+    uint64_t entries;      // set when the log is closed
+    uint64_t cycles;       // set when the log is closed
+    char name[32];
+    char author[32];
+    char released[32];
+};
+
+struct SidLogEntry
+{
+    uint64_t cycle;  /* on the log clock */
+    uint8_t chip;
+    uint8_t reg;
+    uint8_t value;
+};
+
+class SidPackEncoder;
+class SidPackReader;
+
+// Fill in the header for a Sub-Song, the SID layout follows the player
+void sidlog_header(SidLogHeader &header, SidFile &sid, int song_number, uint32_t clock_hz, uint32_t frame_us);
+void sidlog_encode_header(const SidLogHeader &header, uint8_t *out);
+bool sidlog_decode_header(const uint8_t *in, size_t size, SidLogHeader &header);
+
+// Appends SID writes to a log file. Entries go into preallocated blocks,
+// full blocks are written by a background thread; when the disk can't
+// keep up another block is allocated instead of waiting for it. In a
+// packed format the background thread also does the packing.
+// Write and BeginFrame belong to the emulation thread.
+class SidLogWriter
+{
+private:
+    struct Block
+    {
+        std::unique_ptr<uint8_t[]> data;
+        size_t used;
+    };
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::deque<Block *> full;     /* waiting for the flush thread */
+    std::vector<Block *> spare;
+    Block *current;
+    size_t blockSize;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread flusher;
+    bool closing;
+    bool failed;
+
+    FILE *file;
+    int format;
+    std::unique_ptr<SidPackEncoder> pack;
+    uint64_t packClock;   /* log time in the flush thread */
+    SidLogHeader header;
+    uint64_t clock;       /* log time of the last entry */
+    uint64_t frameBase;   /* log time of the current frame */
+    uint64_t frameStart;  /* CPU cycle count at the current frame */
+    uint64_t frames;
+    uint64_t entries;
+    uint64_t extraBlocks;
+
+    void Put(uint16_t delta, uint8_t reg, uint8_t value);
+    void Emit(uint64_t t, uint8_t reg, uint8_t value);
+    void Swap();
+    void Flusher();
+
+public:
+    SidLogWriter();
+    ~SidLogWriter();
+    // SIDLOG_RAW (default) or a packed format, for the next Open
+    void SetFormat(int format);
+    // cpu_cycles is the CPU cycle count the log starts at
+    bool Open(const std::string &path, const SidLogHeader &header, uint64_t cpu_cycles,
+              size_t block_size = 256 << 10, int block_count = 4);
+    bool Close();  /* writes the rest and the final header */
+    bool IsOpen();
+    // a play call starts, its writes are timed from the frame's start
+    void BeginFrame(uint64_t cpu_cycles);
+    // a write to C64 address addr, ignored outside the SIDs of the header
+    void Write(uint64_t cpu_cycles, uint16_t addr, uint8_t value);
+    // an entry already on the log clock, as read from another log
+    void Append(const SidLogEntry &entry);
+    uint64_t GetEntries();
+    uint64_t GetCycles();
+    uint64_t GetExtraBlocks();  /* blocks allocated because flushing fell behind */
+};
+
+// Read-only view of a log file, memory mapped where the platform has
+// mmap, otherwise read into memory. Next() skips clock-only entries.
+// Packed logs are decoded while reading.
+class SidLogReader
+{
+private:
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+    std::vector<uint8_t> buffer;
+    SidLogHeader header;
+    std::unique_ptr<SidPackReader> pack;
+    size_t position;
+    uint64_t clock;
+    uint8_t regs[SIDLOG_MAX_SIDS * 32];  /* register file of a raw log */
+
+public:
+    SidLogReader();
+    ~SidLogReader();
+    bool Open(const std::string &path);
+    void Close();
+    const SidLogHeader &GetHeader();
+    bool Next(SidLogEntry &entry);
+    void Rewind();
+    // continue at the first entry at or after cycle
+    void Seek(uint64_t cycle);
+    // the SID registers as written before the next entry, 32 per SID
+    void GetRegisters(uint8_t *registers);
+    bool IsPacked();
+    size_t GetFileSize();
+};
@@ -0,0 +1,249 @@
+//============================================================================
+// Description : Headless C64 machine running a SID tune
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include "SidMachine.h"
+#include "SidLog.h"
+
+// Clock cycles for the init routine, as CLOCK_CYCLES in sidberry.h
+#define INIT_CYCLES 100000
+// Longest play routine, a full PAL frame
+#define PLAY_CYCLES 19656
+
+void install_microplayer(uint8_t *mem, SidFile &sid, int song_number)
+{
+    for (unsigned int i = 0; i < 65536; i++)
+    {
+        mem[i] = 0x00;
+    }
+
+    uint16_t load = sid.GetLoadAddress();
+    uint16_t len = sid.GetDataLength();
+    uint8_t *buffer = sid.GetDataPtr();
+    for (unsigned int i = 0; i < len; i++)
+    {
+        mem[(uint16_t)(i + load)] = buffer[i];
+    }
+
+    uint16_t play = sid.GetPlayAddress();
+    uint16_t init = sid.GetInitAddress();
+
+    // install reset vector for microplayer (0x0000)
+    mem[0xFFFD] = 0x00;
+    mem[0xFFFC] = 0x00;
+
+    // install IRQ vector for play routine launcher (0x0013)
+    mem[0xFFFF] = 0x00;
+    mem[0xFFFE] = 0x13;
+
+    // install the micro player, 6502 assembly code
+
+    mem[0x0000] = 0xA9; // A = 0, load A with the song number
+    mem[0x0001] = song_number;
+
+    mem[0x0002] = 0x20;               // jump sub to INIT routine
+    mem[0x0003] = init & 0xFF;        // lo addr
+    mem[0x0004] = (init >> 8) & 0xFF; // hi addr
+
+    mem[0x0005] = 0x58; // enable interrupt
+    mem[0x0006] = 0xEA; // nop
+    mem[0x0007] = 0x4C; // jump to 0x0006
+    mem[0x0008] = 0x06;
+    mem[0x0009] = 0x00;
+
+    mem[0x0013] = 0xEA; // nop  //0xA9; // A = 1
+    mem[0x0014] = 0xEA; // nop //0x01;
+    mem[0x0015] = 0xEA; // 0x78 CLI
+    mem[0x0016] = 0x20; // jump sub to play routine
+    mem[0x0017] = play & 0xFF;
+    mem[0x0018] = (play >> 8) & 0xFF;
+    mem[0x0019] = 0xEA; // 0x58 SEI
+    mem[0x001A] = 0x40; // RTI: return from interrupt
+}
+
+thread_local SidMachine *SidMachine::active = nullptr;
+
+int SidMachine::Voice3Chip(uint16_t addr)
+{
+    for (int j = 0; j < sidCount; j++) {
+        if ((uint16_t)(addr - sidAddr[j]) < 0x20) return j;
+    }
+    return -1;
+}
+
+SidChip &SidMachine::Voice3At(int chip)
+{
+    if (cycles > voice3Cycles[chip])  /* a restored snapshot goes back */
+        voice3[chip].Clock(cycles - voice3Cycles[chip]);
+    voice3Cycles[chip] = cycles;
+    return voice3[chip];
+}
+
+void SidMachine::Voice3Start()
+{
+    for (int j = 0; j < sidCount; j++) {
+        for (int i = 0; i <= 0x18; i++) {
+            voice3[j].Write(i, memory[sidAddr[j] + i]);
+        }
+        voice3Cycles[j] = cycles;
+    }
+    voice3Live = true;
+}
+
+uint8_t SidMachine::IORead(uint16_t addr)
+{
+    SidMachine *m = active;
+    if (sid_voice3_read(addr))
+    { /* a lone SID is mirrored, as MemRead */
+        if (!m->voice3Live) m->Voice3Start();
+        int chip = m->Voice3Chip(addr);
+        return m->Voice3At(chip < 0 ? 0 : chip).Read(addr & 0x1F);
+    }
+    return m->memory[addr];
+}
+
+void SidMachine::IOWrite(uint16_t addr, uint8_t byte)
+{
+    SidMachine *m = active;
+    if (sid_io_address(addr))
+    {
+        int chip = (m->voice3Live ? m->Voice3Chip(addr) : -1);
+        if (chip >= 0) m->Voice3At(chip).Write(addr & 0x1F, byte);
+        m->sidWrites++;
+        if (m->log) m->log->Write(m->cycles, addr, byte);
+        if (m->hook) m->hook(m->hookUser, m->cycles, addr, byte);
+    }
+    m->memory[addr] = byte;
+}
+
+SidMachine::SidMachine() : cpu(IORead, IOWrite)
+{
+    cycles = 0;
+    sidWrites = 0;
+    sidCount = 0;
+    voice3Live = false;
+    memoryHash = 0;
+    log = nullptr;
+    hook = nullptr;
+    hookUser = nullptr;
+    for (int i = 0; i < 256; i++) {
+        pageHash[i] = 0;
+    }
+    for (int j = 0; j < SIDLOG_MAX_SIDS; j++) {
+        voice3Cycles[j] = 0;
+        sidAddr[j] = 0;
+    }
+    cpu.SetRAM(memory);
+    cpu.SetPageFlags(0x00, 0xD3, mos6502::PAGE_DIRECT);
+    cpu.SetPageFlags(0xD4, 0xDF, mos6502::PAGE_VOLATILE);
+    cpu.SetPageFlags(0xE0, 0xFF, mos6502::PAGE_DIRECT);
+    cpu.SetIdleSkip(true);
+    cpu.SetBlockCache(true);
+    cpu.SetRTILimit(PLAY_CYCLES);
+}
+
+void SidMachine::Load(SidFile &sid, int song_number)
+{
+    active = this;
+    install_microplayer(memory, sid, song_number);
+    cycles = 0;
+    sidWrites = 0;
+    SidLogHeader header;
+    sidlog_header(header, sid, song_number, 0, 0);
+    sidCount = header.sid_count;
+    for (int j = 0; j < SIDLOG_MAX_SIDS; j++) {
+        voice3[j].Reset(sidemu_model(header.chip_type[j]), 44100);
+        voice3Cycles[j] = 0;
+        sidAddr[j] = header.sid_addr[j];
+    }
+    voice3Live = false;
+    cpu.InvalidateCode();
+    cpu.Reset();
+    cpu.RunN(INIT_CYCLES, cycles);
+}
+
+bool SidMachine::Play()
+{
+    active = this;
+    if (log) log->BeginFrame(cycles);
+    cpu.IRQ();
+    uint64_t start = cycles;
+    cpu.RunN(0, cycles);
+    return (cycles - start) < PLAY_CYCLES;
+}
+
+void SidMachine::Save(SidSnapshot &snap, PagePool &pool)
+{
+    snap.Save(cpu, cycles, memory, pool);
+}
+
+void SidMachine::Restore(const SidSnapshot &snap)
+{
+    snap.Restore(cpu, cycles, memory);
+}
+
+static uint64_t HashWords(const uint8_t *p, int length, uint64_t h)
+{
+    for (int i = 0; i < length; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+uint64_t SidMachine::GetStateHash()
+{
+    for (int i = 0; i < 256; i++) {
+        if (cpu.IsPageDirty(i)) {
+            memoryHash -= pageHash[i];
+            pageHash[i] = HashWords(memory + (i << 8), 256, (i + 1) * 0x9E3779B97F4A7C15ULL);
+            memoryHash += pageHash[i];
+        }
+    }
+    cpu.ResetDirtyPages();
+
+    mos6502::State state;
+    cpu.GetState(state);
+    uint8_t regs[8] = { state.A, state.X, state.Y, state.sp, state.status,
+                        (uint8_t)state.pc, (uint8_t)(state.pc >> 8), state.illegalOpcode };
+    return HashWords(regs, 8, memoryHash);
+}
+
+void SidMachine::SetLog(SidLogWriter *log)
+{
+    this->log = log;
+}
+
+void SidMachine::SetWriteHook(WriteHook hook, void *user)
+{
+    this->hook = hook;
+    hookUser = user;
+}
+
+uint8_t *SidMachine::GetMemory()
+{
+    return memory;
+}
+
+uint64_t SidMachine::GetCycles()
+{
+    return cycles;
+}
+
+uint64_t SidMachine::GetSIDWrites()
+{
+    return sidWrites;
+}
+
+uint32_t SidMachine::GetPlayRate(SidFile &sid, int song_number, uint32_t refresh_us)
+{
+    if (sid.GetSongSpeed(song_number) & (1 << song_number)) {
+        uint32_t timer = (memory[0xDC05] << 8) | memory[0xDC04];
+        if (timer) return timer;
+    }
+    return refresh_us;
+}
@@ -0,0 +1,86 @@
+//============================================================================
+// Description : Headless C64 machine running a SID tune
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <cstdint>
+
+#include "mos6502/mos6502.h"
+#include "SidEmu.h"
+#include "SidFile.h"
+#include "Snapshot.h"
+
+class SidLogWriter;
+
+// Install the tune and the micro player (reset vector 0x0000: init the
+// Sub-Song and idle, IRQ vector 0x0013: call play and RTI) into memory
+void install_microplayer(uint8_t *mem, SidFile &sid, int song_number);
+
+// The SID area as the player decodes it: $D400-$D5FF and I/O 1 and 2 at
+// $DE00-$DFFF, each SID taking 32 bytes
+inline bool sid_io_address(uint16_t addr)
+{
+    return (addr >= 0xD400 && addr <= 0xD5FF) || (addr >= 0xDE00 && addr <= 0xDFFF);
+}
+
+// A read of OSC3 or ENV3 ($1B, $1C) of a SID there, not of the CIAs
+inline bool sid_voice3_read(uint16_t addr)
+{
+    return sid_io_address(addr) && ((addr & 0x1F) == 0x1B || (addr & 0x1F) == 0x1C);
+}
+
+// A C64 with its own 64K that plays a tune without any output device:
+// SID writes only land in its memory. OSC3/ENV3 reads are answered by a
+// voice 3 model per SID as in the player, started at the first such read
+// from the registers in memory, so tunes that never read pay nothing.
+// Every instance is independent, one thread can run one machine at a time.
+class SidMachine
+{
+public:
+    typedef void (*WriteHook)(void *user, uint64_t cycles, uint16_t addr, uint8_t value);
+
+private:
+    uint8_t memory[65536];
+    mos6502 cpu;
+    uint64_t cycles;
+    uint64_t sidWrites;
+    SidChip voice3[SIDLOG_MAX_SIDS];  /* clocked up to voice3Cycles */
+    bool voice3Live;                  /* hearing the writes */
+    uint64_t voice3Cycles[SIDLOG_MAX_SIDS];
+    uint16_t sidAddr[SIDLOG_MAX_SIDS];
+    int sidCount;
+    uint64_t pageHash[256];  /* per page, updated for dirty pages only */
+    uint64_t memoryHash;     /* sum of pageHash */
+    SidLogWriter *log;
+    WriteHook hook;
+    void *hookUser;
+
+    static thread_local SidMachine *active;
+    static uint8_t IORead(uint16_t addr);
+    static void IOWrite(uint16_t addr, uint8_t byte);
+    int Voice3Chip(uint16_t addr);  /* -1 if no SID of the tune */
+    void Voice3Start();
+    SidChip &Voice3At(int chip);
+
+public:
+    SidMachine();
+    void Load(SidFile &sid, int song_number);  /* runs the init routine */
+    bool Play();  /* one call of the play routine, false if it didn't return */
+    void Save(SidSnapshot &snap, PagePool &pool);
+    void Restore(const SidSnapshot &snap);
+    uint8_t *GetMemory();
+    uint64_t GetCycles();
+    uint64_t GetSIDWrites();
+    // microseconds between play calls as the player times them: refresh_us,
+    // or the CIA 1 timer set by init for CIA timed Sub-Songs
+    uint32_t GetPlayRate(SidFile &sid, int song_number, uint32_t refresh_us);
+    // hash of the registers and memory; rehashes the pages dirtied since
+    // the previous call, so don't mix with other users of the dirty pages
+    uint64_t GetStateHash();
+    // record the SID writes and play calls from here on, nullptr to stop
+    void SetLog(SidLogWriter *log);
+    // also pass every SID write with the cycle count to hook, nullptr to stop
+    void SetWriteHook(WriteHook hook, void *user);
+};
@@ -0,0 +1,443 @@
+//============================================================================
+// Description : Compressed container for SID write logs
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cstring>
+
+#include "SidPack.h"
+
+static const char sidpack_magic[8] = { 'S', 'I', 'D', 'B', 'P', 'A', 'C', 'K' };
+
+// Contexts of the range coder, 256 probabilities each
+#define CTX_REGFILE 0
+#define CTX_REG     1                       // + previous register
+#define CTX_GAP     (CTX_REG + 128)         // + register, first gap byte
+#define CTX_GAPMORE (CTX_GAP + 128)         // further gap bytes
+#define CTX_VALUE   (CTX_GAPMORE + 1)       // + register
+#define CTX_COUNT   (CTX_VALUE + 128)
+
+#define PROB_BITS  11
+#define PROB_INIT  (1 << (PROB_BITS - 1))
+#define PROB_MOVE  5
+#define RANGE_TOP  (1u << 24)
+
+// Byte stream of a block: stored as is, or range coded with adaptive
+// binary probabilities (the coder of LZMA) over an 8 bit tree per context
+class SidPackCoder
+{
+private:
+    bool entropy;
+    uint16_t probs[CTX_COUNT][256];
+    /* encoder */
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint64_t cacheSize;
+    /* decoder */
+    const uint8_t *in;
+    const uint8_t *end;
+    uint32_t code;
+
+    void ShiftLow()
+    {
+        if ((uint32_t)low < 0xFF000000u || (low >> 32) != 0) {
+            uint8_t carry = low >> 32;
+            uint8_t temp = cache;
+            do {
+                out.push_back(temp + carry);
+                temp = 0xFF;
+            } while (--cacheSize != 0);
+            cache = (uint8_t)(low >> 24);
+        }
+        cacheSize++;
+        low = (low & 0x00FFFFFF) << 8;
+    }
+
+    uint8_t ReadIn()
+    {
+        return in < end ? *in++ : 0;
+    }
+
+public:
+    std::vector<uint8_t> out;
+
+    SidPackCoder(bool entropy) : entropy(entropy) {}
+
+    void BeginEncode()
+    {
+        out.clear();
+        if (!entropy) return;
+        for (int c = 0; c < CTX_COUNT; c++) {
+            for (int i = 0; i < 256; i++) {
+                probs[c][i] = PROB_INIT;
+            }
+        }
+        low = 0;
+        range = 0xFFFFFFFFu;
+        cache = 0;
+        cacheSize = 1;
+    }
+
+    void Put(int ctx, uint8_t byte)
+    {
+        if (!entropy) {
+            out.push_back(byte);
+            return;
+        }
+        uint16_t *p = probs[ctx];
+        unsigned int m = 1;
+        for (int i = 7; i >= 0; i--) {
+            unsigned int bit = (byte >> i) & 1;
+            uint32_t bound = (range >> PROB_BITS) * p[m];
+            if (bit == 0) {
+                range = bound;
+                p[m] += ((1 << PROB_BITS) - p[m]) >> PROB_MOVE;
+            } else {
+                low += bound;
+                range -= bound;
+                p[m] -= p[m] >> PROB_MOVE;
+            }
+            m = (m << 1) | bit;
+            while (range < RANGE_TOP) {
+                range <<= 8;
+                ShiftLow();
+            }
+        }
+    }
+
+    void EndEncode()
+    {
+        if (!entropy) return;
+        for (int i = 0; i < 5; i++) {
+            ShiftLow();
+        }
+    }
+
+    void BeginDecode(const uint8_t *data, size_t size)
+    {
+        in = data;
+        end = data + size;
+        if (!entropy) return;
+        for (int c = 0; c < CTX_COUNT; c++) {
+            for (int i = 0; i < 256; i++) {
+                probs[c][i] = PROB_INIT;
+            }
+        }
+        range = 0xFFFFFFFFu;
+        code = 0;
+        for (int i = 0; i < 5; i++) {
+            code = (code << 8) | ReadIn();
+        }
+    }
+
+    uint8_t Get(int ctx)
+    {
+        if (!entropy) return ReadIn();
+        uint16_t *p = probs[ctx];
+        unsigned int m = 1;
+        for (int i = 0; i < 8; i++) {
+            uint32_t bound = (range >> PROB_BITS) * p[m];
+            if (code < bound) {
+                range = bound;
+                p[m] += ((1 << PROB_BITS) - p[m]) >> PROB_MOVE;
+                m <<= 1;
+            } else {
+                code -= bound;
+                range -= bound;
+                p[m] -= p[m] >> PROB_MOVE;
+                m = (m << 1) | 1;
+            }
+            if (range < RANGE_TOP) {
+                range <<= 8;
+                code = (code << 8) | ReadIn();
+            }
+        }
+        return m & 0xFF;
+    }
+};
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (i * 8);
+    }
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        p[i] = v >> (i * 8);
+    }
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void encode_header(uint8_t *out, uint16_t flags, uint32_t blocks, uint64_t index, const SidLogHeader &header)
+{
+    memcpy(out, sidpack_magic, 8);
+    out[8] = SIDPACK_VERSION;
+    out[9] = SIDPACK_VERSION >> 8;
+    out[10] = flags;
+    out[11] = flags >> 8;
+    put32(out + 12, blocks);
+    put64(out + 16, index);
+    sidlog_encode_header(header, out + 24);
+}
+
+SidPackEncoder::SidPackEncoder()
+{
+    file = NULL;
+    flags = 0;
+    sidCount = 1;
+    blockEntries = SIDPACK_BLOCK_ENTRIES;
+    lastReg = 0;
+    clock = entries = 0;
+    failed = false;
+    memset(regs, 0, sizeof(regs));
+}
+
+SidPackEncoder::~SidPackEncoder()
+{
+}
+
+bool SidPackEncoder::Begin(FILE *file, const SidLogHeader &header, bool entropy, uint32_t block_entries)
+{
+    this->file = file;
+    flags = entropy ? SIDPACK_ENTROPY : 0;
+    sidCount = header.sid_count;
+    blockEntries = block_entries ? block_entries : SIDPACK_BLOCK_ENTRIES;
+    coder.reset(new SidPackCoder(entropy));
+    index.clear();
+    memset(regs, 0, sizeof(regs));
+    clock = entries = 0;
+    failed = false;
+
+    uint8_t raw[SIDPACK_FILE_HEADER];
+    encode_header(raw, flags, 0, 0, header);
+    failed = fwrite(raw, SIDPACK_FILE_HEADER, 1, file) != 1;
+    return !failed;
+}
+
+void SidPackEncoder::Add(const SidLogEntry &entry)
+{
+    if (index.empty() || index.back().entries == blockEntries) {
+        if (!index.empty()) EndBlock();
+        Block b = { 0, clock, entries, 0, 0 };
+        index.push_back(b);
+        coder->BeginEncode();
+        for (int i = 0; i < sidCount * 32; i++) {
+            coder->Put(CTX_REGFILE, regs[i]);
+        }
+        lastReg = 0;
+    }
+
+    uint8_t reg = ((entry.chip << 5) | entry.reg) & 0x7F;
+    bool same = regs[reg] == entry.value;
+    coder->Put(CTX_REG + lastReg, reg | (same ? 0x80 : 0));
+    uint64_t gap = entry.cycle > clock ? entry.cycle - clock : 0;
+    int ctx = CTX_GAP + reg;
+    while (gap >= 0x80) {
+        coder->Put(ctx, (gap & 0x7F) | 0x80);
+        gap >>= 7;
+        ctx = CTX_GAPMORE;
+    }
+    coder->Put(ctx, gap);
+    if (!same) {
+        coder->Put(CTX_VALUE + reg, entry.value ^ regs[reg]);
+    }
+
+    regs[reg] = entry.value;
+    lastReg = reg;
+    clock = entry.cycle > clock ? entry.cycle : clock;
+    entries++;
+    index.back().entries++;
+}
+
+void SidPackEncoder::EndBlock()
+{
+    coder->EndEncode();
+    Block &b = index.back();
+    b.offset = ftell(file);
+    b.size = coder->out.size();
+    if (b.size && fwrite(coder->out.data(), b.size, 1, file) != 1)
+        failed = true;
+}
+
+bool SidPackEncoder::Finish(const SidLogHeader &header)
+{
+    if (!index.empty()) EndBlock();
+    uint64_t at = ftell(file);
+    for (Block &b : index) {
+        uint8_t raw[SIDPACK_INDEX_SIZE];
+        put64(raw, b.offset);
+        put64(raw + 8, b.start);
+        put64(raw + 16, b.first);
+        put32(raw + 24, b.size);
+        put32(raw + 28, b.entries);
+        if (fwrite(raw, SIDPACK_INDEX_SIZE, 1, file) != 1)
+            failed = true;
+    }
+    SidLogHeader final = header;
+    final.entries = entries;
+    final.cycles = clock;
+    uint8_t raw[SIDPACK_FILE_HEADER];
+    encode_header(raw, flags, index.size(), at, final);
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(raw, SIDPACK_FILE_HEADER, 1, file) != 1)
+        failed = true;
+    return !failed;
+}
+
+uint64_t SidPackEncoder::GetEntries()
+{
+    return entries;
+}
+
+SidPackReader::SidPackReader()
+{
+    data = index = nullptr;
+    size = 0;
+    flags = 0;
+    sidCount = 1;
+    blocks = block = left = 0;
+    lastReg = 0;
+    clock = 0;
+    pending = false;
+    memset(regs, 0, sizeof(regs));
+}
+
+SidPackReader::~SidPackReader()
+{
+}
+
+bool SidPackReader::IsPack(const uint8_t *data, size_t size)
+{
+    return size >= SIDPACK_FILE_HEADER && memcmp(data, sidpack_magic, 8) == 0;
+}
+
+bool SidPackReader::Open(const uint8_t *data, size_t size, SidLogHeader &header)
+{
+    if (!IsPack(data, size) || (data[8] | (data[9] << 8)) != SIDPACK_VERSION) return false;
+    if (!sidlog_decode_header(data + 24, size - 24, header)) return false;
+    this->data = data;
+    this->size = size;
+    flags = data[10] | (data[11] << 8);
+    blocks = get32(data + 12);
+    uint64_t at = get64(data + 16);
+    if (at > size || (size - at) / SIDPACK_INDEX_SIZE < blocks) return false;  /* not closed */
+    index = data + at;
+    for (uint32_t i = 0; i < blocks; i++) {
+        const uint8_t *b = index + i * SIDPACK_INDEX_SIZE;
+        if (get64(b) > at || get32(b + 24) > at - get64(b)) return false;
+    }
+    sidCount = header.sid_count;
+    coder.reset(new SidPackCoder(flags & SIDPACK_ENTROPY));
+    Rewind();
+    return true;
+}
+
+bool SidPackReader::LoadBlock(uint32_t n)
+{
+    if (n >= blocks) return false;
+    const uint8_t *b = index + n * SIDPACK_INDEX_SIZE;
+    coder->BeginDecode(data + get64(b), get32(b + 24));
+    clock = get64(b + 8);
+    left = get32(b + 28);
+    block = n + 1;
+    memset(regs, 0, sizeof(regs));
+    for (int i = 0; i < sidCount * 32; i++) {
+        regs[i] = coder->Get(CTX_REGFILE);
+    }
+    lastReg = 0;
+    return true;
+}
+
+bool SidPackReader::Decode(SidLogEntry &entry)
+{
+    while (left == 0) {
+        if (!LoadBlock(block)) return false;
+    }
+    uint8_t token = coder->Get(CTX_REG + lastReg);
+    uint8_t reg = token & 0x7F;
+    uint64_t gap = 0;
+    int shift = 0;
+    int ctx = CTX_GAP + reg;
+    for (;;) {
+        uint8_t byte = coder->Get(ctx);
+        gap |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80) || shift > 56) break;
+        shift += 7;
+        ctx = CTX_GAPMORE;
+    }
+    if (!(token & 0x80)) {
+        regs[reg] ^= coder->Get(CTX_VALUE + reg);
+    }
+    clock += gap;
+    lastReg = reg;
+    left--;
+
+    entry.cycle = clock;
+    entry.chip = reg >> 5;
+    entry.reg = reg & 0x1F;
+    entry.value = regs[reg];
+    return true;
+}
+
+bool SidPackReader::Next(SidLogEntry &entry)
+{
+    if (pending) {
+        pending = false;
+        entry = pendingEntry;
+        return true;
+    }
+    return Decode(entry);
+}
+
+void SidPackReader::Rewind()
+{
+    block = left = 0;
+    clock = 0;
+    pending = false;
+    lastReg = 0;
+    memset(regs, 0, sizeof(regs));
+}
+
+void SidPackReader::Seek(uint64_t cycle)
+{
+    /* last block starting before cycle, the index is in time order */
+    uint32_t lo = 0, hi = blocks;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (get64(index + mid * SIDPACK_INDEX_SIZE + 8) < cycle)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    Rewind();
+    if (!LoadBlock(lo)) return;
+    for (;;) {
+        memcpy(pendingRegs, regs, sizeof(regs));
+        if (!Decode(pendingEntry)) return;
+        if (pendingEntry.cycle >= cycle) break;
+    }
+    pending = true;
+}
+
+void SidPackReader::GetRegisters(uint8_t *registers)
+{
+    memcpy(registers, pending ? pendingRegs : regs, SIDPACK_REGISTERS);
+}
+
+uint32_t SidPackReader::GetBlockCount()
+{
+    return blocks;
+}
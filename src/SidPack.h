@@ -0,0 +1,113 @@
+//============================================================================
+// Description : Compressed container for SID write logs
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// File layout, all numbers little endian:
+//   0   "SIDBPACK"
+//   8   uint16 version, uint16 flags (SIDPACK_ENTROPY)
+//   12  uint32 block count
+//   16  uint64 offset of the block index
+//   24  the SidLogHeader as in a raw log, SIDLOG_HEADER_SIZE bytes
+//   blocks, then the index with SIDPACK_INDEX_SIZE bytes per block:
+//     uint64 offset, uint64 log time before the first entry,
+//     uint64 number of the first entry, uint32 stored size, uint32 entries
+// Every block decodes on its own. It starts with the register file
+// (32 bytes per SID) followed by one token per entry:
+//     uint8  chip << 5 | register, bit 7 set when the value is unchanged
+//     varint cycles since the previous entry
+//     uint8  value xor the register file, only when bit 7 is clear
+// With SIDPACK_ENTROPY the token bytes are range coded with adaptive
+// probabilities, reset at every block, in contexts of the previous
+// register (register bytes) or the register written (gaps and values).
+
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "SidLog.h"
+
+#define SIDPACK_VERSION       1
+#define SIDPACK_ENTROPY       0x0001
+#define SIDPACK_FILE_HEADER   (24 + SIDLOG_HEADER_SIZE)
+#define SIDPACK_INDEX_SIZE    32
+#define SIDPACK_BLOCK_ENTRIES 16384
+#define SIDPACK_REGISTERS     (SIDLOG_MAX_SIDS * 32)
+
+class SidPackCoder;
+
+// Encodes entries into blocks and writes them to an open file
+class SidPackEncoder
+{
+private:
+    struct Block
+    {
+        uint64_t offset;
+        uint64_t start;  /* log time before the first entry */
+        uint64_t first;
+        uint32_t size;
+        uint32_t entries;
+    };
+    FILE *file;
+    uint16_t flags;
+    int sidCount;
+    uint32_t blockEntries;
+    std::unique_ptr<SidPackCoder> coder;
+    std::vector<Block> index;
+    uint8_t regs[SIDPACK_REGISTERS];
+    uint8_t lastReg;
+    uint64_t clock;
+    uint64_t entries;
+    bool failed;
+
+    void EndBlock();
+
+public:
+    SidPackEncoder();
+    ~SidPackEncoder();
+    bool Begin(FILE *file, const SidLogHeader &header, bool entropy, uint32_t block_entries = SIDPACK_BLOCK_ENTRIES);
+    void Add(const SidLogEntry &entry);
+    // ends the last block, writes the index and the final header
+    bool Finish(const SidLogHeader &header);
+    uint64_t GetEntries();
+};
+
+// Streaming decoder over a packed log in memory
+class SidPackReader
+{
+private:
+    const uint8_t *data;
+    size_t size;
+    uint16_t flags;
+    int sidCount;
+    const uint8_t *index;
+    uint32_t blocks;
+    std::unique_ptr<SidPackCoder> coder;
+    uint32_t block;    /* next block to load */
+    uint32_t left;     /* entries left in the current block */
+    uint8_t regs[SIDPACK_REGISTERS];
+    uint8_t lastReg;
+    uint64_t clock;
+    bool pending;      /* Seek decoded the next entry already */
+    SidLogEntry pendingEntry;
+    uint8_t pendingRegs[SIDPACK_REGISTERS];
+
+    bool LoadBlock(uint32_t n);
+    bool Decode(SidLogEntry &entry);
+
+public:
+    SidPackReader();
+    ~SidPackReader();
+    static bool IsPack(const uint8_t *data, size_t size);
+    bool Open(const uint8_t *data, size_t size, SidLogHeader &header);
+    bool Next(SidLogEntry &entry);
+    void Rewind();
+    // continue at the first entry at or after cycle
+    void Seek(uint64_t cycle);
+    // the register file before the next entry
+    void GetRegisters(uint8_t *registers);
+    uint32_t GetBlockCount();
+};
@@ -0,0 +1,130 @@
+//============================================================================
+// Description : Machine snapshots with deduplicated memory pages
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include "Snapshot.h"
+
+const uint8_t *PagePool::Intern(const uint8_t *page)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    /* set nodes don't move, the string data stays valid */
+    return (const uint8_t *)pages.emplace((const char *)page, 256).first->data();
+}
+
+size_t PagePool::GetPageCount()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return pages.size();
+}
+
+void SidSnapshot::Save(mos6502 &cpu, uint64_t cycles, const uint8_t *memory, PagePool &pool)
+{
+    cpu.GetState(this->cpu);
+    cyclecount = cycles;
+    for (int i = 0; i < 256; i++) {
+        pages[i] = pool.Intern(memory + (i << 8));
+    }
+}
+
+void SidSnapshot::Restore(mos6502 &cpu, uint64_t &cycles, uint8_t *memory) const
+{
+    for (int i = 0; i < 256; i++) {
+        memcpy(memory + (i << 8), pages[i], 256);
+    }
+    cycles = cyclecount;
+    cpu.InvalidateCode();
+    cpu.SetState(this->cpu);
+}
+
+#define REWIND_PAGE_BYTES (256 + 32)  /* page and shared_ptr control block */
+
+RewindRing::RewindRing(size_t capacity)
+{
+    bytes = 0;
+    cap = capacity;
+}
+
+void RewindRing::SetCapacity(size_t capacity)
+{
+    cap = capacity;
+    while (!entries.empty() && bytes > cap) {
+        Release(entries.front(), entries.size() > 1 ? &entries[1] : nullptr);
+        entries.pop_front();
+    }
+}
+
+/* A page is counted once, by the entry that copied it. Dropping an entry
+   uncounts the pages it doesn't share with its remaining neighbour: the
+   next one when dropping the oldest, the previous one when dropping the
+   newest. */
+void RewindRing::Release(Entry &entry, const Entry *neighbour)
+{
+    bytes -= sizeof(Entry);
+    for (int i = 0; i < 256; i++) {
+        if (!neighbour || neighbour->pages[i] != entry.pages[i])
+            bytes -= REWIND_PAGE_BYTES;
+        entry.pages[i].reset();
+    }
+}
+
+void RewindRing::Push(mos6502 &cpu, uint64_t cycles, const uint8_t *memory, uint32_t frame)
+{
+    if (cap == 0) return;
+    entries.emplace_back();
+    Entry &entry = entries.back();
+    const Entry *prev = entries.size() > 1 ? &entries[entries.size() - 2] : nullptr;
+    cpu.GetState(entry.cpu);
+    entry.cyclecount = cycles;
+    entry.frame = frame;
+    bytes += sizeof(Entry);
+    for (int i = 0; i < 256; i++) {
+        const uint8_t *page = memory + (i << 8);
+        if (prev && (!cpu.IsPageDirty(i) || memcmp(prev->pages[i].get(), page, 256) == 0)) {
+            entry.pages[i] = prev->pages[i];
+        } else {
+            uint8_t *copy = new uint8_t[256];
+            memcpy(copy, page, 256);
+            entry.pages[i] = std::shared_ptr<const uint8_t>(copy, std::default_delete<uint8_t[]>());
+            bytes += REWIND_PAGE_BYTES;
+        }
+    }
+    cpu.ResetDirtyPages();
+    SetCapacity(cap);
+}
+
+bool RewindRing::Restore(uint32_t frame, mos6502 &cpu, uint64_t &cycles, uint8_t *memory, uint32_t &restored)
+{
+    while (!entries.empty() && entries.back().frame > frame) {
+        Release(entries.back(), entries.size() > 1 ? &entries[entries.size() - 2] : nullptr);
+        entries.pop_back();
+    }
+    if (entries.empty()) return false;
+
+    const Entry &entry = entries.back();
+    for (int i = 0; i < 256; i++) {
+        memcpy(memory + (i << 8), entry.pages[i].get(), 256);
+    }
+    cycles = entry.cyclecount;
+    cpu.InvalidateCode();
+    cpu.SetState(entry.cpu);
+    restored = entry.frame;
+    return true;
+}
+
+void RewindRing::Clear()
+{
+    entries.clear();
+    bytes = 0;
+}
+
+size_t RewindRing::GetBytes()
+{
+    return bytes;
+}
+
+size_t RewindRing::GetCount()
+{
+    return entries.size();
+}
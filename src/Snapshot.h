@@ -0,0 +1,72 @@
+//============================================================================
+// Description : Machine snapshots with deduplicated memory pages
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include "mos6502/mos6502.h"
+
+// Shared store of 256 byte memory pages, identical pages are kept once.
+// Pages are never freed while the pool lives; safe to use from any thread.
+class PagePool
+{
+private:
+    std::mutex lock;
+    std::unordered_set<std::string> pages;
+
+public:
+    const uint8_t *Intern(const uint8_t *page);
+    size_t GetPageCount();
+};
+
+// CPU registers, cycle counter and 64K memory image (RAM and the I/O
+// register shadow) of a machine, memory kept as pages in a PagePool
+struct SidSnapshot
+{
+    mos6502::State cpu;
+    uint64_t cyclecount;
+    const uint8_t *pages[256];
+
+    void Save(mos6502 &cpu, uint64_t cycles, const uint8_t *memory, PagePool &pool);
+    void Restore(mos6502 &cpu, uint64_t &cycles, uint8_t *memory) const;
+};
+
+// Snapshots taken while playing, oldest dropped once the memory cap is
+// reached. A page unchanged since the previous snapshot is shared with it,
+// only the CPU's dirty pages are compared; Push() resets them.
+class RewindRing
+{
+private:
+    struct Entry
+    {
+        mos6502::State cpu;
+        uint64_t cyclecount;
+        uint32_t frame;
+        std::shared_ptr<const uint8_t> pages[256];
+    };
+    std::deque<Entry> entries;
+    size_t bytes;
+    size_t cap;
+
+    void Release(Entry &entry, const Entry *neighbour);
+
+public:
+    RewindRing(size_t capacity = 0);
+    void SetCapacity(size_t capacity);  /* bytes, 0 disables the ring */
+    void Push(mos6502 &cpu, uint64_t cycles, const uint8_t *memory, uint32_t frame);
+    // restore the newest snapshot at or before frame, newer ones are dropped;
+    // returns false if there is none
+    bool Restore(uint32_t frame, mos6502 &cpu, uint64_t &cycles, uint8_t *memory, uint32_t &restored);
+    void Clear();
+    size_t GetBytes();
+    size_t GetCount();
+};
@@ -0,0 +1,160 @@
+//============================================================================
+// Description : Song length and loop point detection
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <memory>
+#include <unordered_map>
+
+#include "SongLength.h"
+#include "SidMachine.h"
+
+static const char *kinds[3] = { "none", "end", "loop" };
+
+uint64_t sid_hash(SidFile &sid)
+{
+    uint64_t h = 1469598103934665603ULL;  /* FNV-1a */
+    uint8_t *data = sid.GetDataPtr();
+    for (unsigned int i = 0; i < sid.GetDataLength(); i++) {
+        h = (h ^ data[i]) * 1099511628211ULL;
+    }
+    uint16_t fields[4] = { sid.GetLoadAddress(), sid.GetInitAddress(), sid.GetPlayAddress(), (uint16_t)sid.GetNumOfSongs() };
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ fields[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/* No voice gated or the volume at zero, on every SID */
+static bool sid_silent(const uint8_t *mem, const uint16_t *bases, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const uint8_t *sid = mem + bases[i];
+        if ((sid[0x18] & 0x0F) && ((sid[0x04] | sid[0x0B] | sid[0x12]) & 0x01))
+            return false;
+    }
+    return true;
+}
+
+SongLength analyse_song(SidFile &sid, int song_number, int refresh_us)
+{
+    SongLength result = { SONGLENGTH_NONE, 0, 0 };
+    if (sid.GetPlayAddress() == 0) return result;  /* play routine installed by init, unsupported */
+
+    std::unique_ptr<SidMachine> machine(new SidMachine);
+    machine->Load(sid, song_number);
+    uint8_t *mem = machine->GetMemory();
+
+    /* same timing and SID addresses as the player */
+    uint32_t frame_us = machine->GetPlayRate(sid, song_number, refresh_us);
+    uint16_t bases[4] = { 0xD400 };
+    int sv = sid.GetSidVersion();
+    int count = (sv == 3 ? 2 : sv == 4 ? 3 : sv == 78 ? 4 : 1);
+    for (int i = 1; i < count; i++) {
+        bases[i] = 0xD000 | (sid.GetSIDaddr(i + 1) << 4);
+    }
+
+    uint32_t max_frames = (uint64_t)SONGLENGTH_MAX_SECONDS * 1000000 / frame_us;
+    uint32_t silence_frames = (uint64_t)SONGLENGTH_SILENCE_SECONDS * 1000000 / frame_us;
+    uint32_t silent_since = 0;
+    bool silent = false;
+    std::unordered_map<uint64_t, uint32_t> seen;
+    seen.reserve(max_frames);
+    seen.emplace(machine->GetStateHash(), 0);
+
+    for (uint32_t frame = 1; frame <= max_frames; frame++) {
+        if (!machine->Play()) break;  /* waits for something not emulated */
+
+        if (!sid_silent(mem, bases, count)) {
+            silent = false;
+        } else if (!silent) {
+            silent = true;
+            silent_since = frame;
+        }
+
+        auto hit = seen.emplace(machine->GetStateHash(), frame);
+        if (!hit.second) {  /* been here before */
+            if (silent && silent_since <= hit.first->second) {  /* looping in silence */
+                result.kind = SONGLENGTH_END;
+                result.length_ms = (uint64_t)silent_since * frame_us / 1000;
+            } else {
+                result.kind = SONGLENGTH_LOOP;
+                result.length_ms = (uint64_t)frame * frame_us / 1000;
+                result.loop_ms = (uint64_t)hit.first->second * frame_us / 1000;
+            }
+            break;
+        }
+        if (silent && (frame - silent_since) >= silence_frames) {
+            result.kind = SONGLENGTH_END;
+            result.length_ms = (uint64_t)silent_since * frame_us / 1000;
+            break;
+        }
+    }
+    return result;
+}
+
+std::string songlength_time(uint32_t ms)
+{
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u:%02u.%03u", ms / 60000, (ms / 1000) % 60, ms % 1000);
+    return buffer;
+}
+
+bool SongLengthCache::Load(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) return false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long hash;
+        int song_number, name_at = 0;
+        char kind[8];
+        Entry entry;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%llx %d %7s %u %u %n", &hash, &song_number, kind, &entry.length.length_ms, &entry.length.loop_ms, &name_at) < 5)
+            continue;
+        entry.length.kind = SONGLENGTH_NONE;
+        for (int i = 0; i < 3; i++) {
+            if (!strcmp(kind, kinds[i])) entry.length.kind = i;
+        }
+        entry.name = std::string(line + name_at);
+        while (!entry.name.empty() && (entry.name.back() == '\n' || entry.name.back() == '\r'))
+            entry.name.pop_back();
+        entries[std::make_pair((uint64_t)hash, song_number)] = entry;
+    }
+    fclose(f);
+    return true;
+}
+
+bool SongLengthCache::Save(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) return false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    fprintf(f, "# SidBerry song lengths: tune hash, Sub-Song, end|loop|none, length ms, loop ms, file name\n");
+    for (auto &e : entries) {
+        fprintf(f, "%016llx %d %s %u %u %s\n", (unsigned long long)e.first.first, e.first.second,
+                kinds[e.second.length.kind], e.second.length.length_ms, e.second.length.loop_ms, e.second.name.c_str());
+    }
+    fclose(f);
+    return true;
+}
+
+bool SongLengthCache::Find(uint64_t hash, int song_number, SongLength &length)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto e = entries.find(std::make_pair(hash, song_number));
+    if (e == entries.end()) return false;
+    length = e->second.length;
+    return true;
+}
+
+void SongLengthCache::Set(uint64_t hash, int song_number, const SongLength &length, const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    entries[std::make_pair(hash, song_number)] = { length, name };
+}
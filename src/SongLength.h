@@ -0,0 +1,61 @@
+//============================================================================
+// Description : Song length and loop point detection
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "SidFile.h"
+
+#define SONGLENGTH_MAX_SECONDS     900  // give up after 15 minutes
+#define SONGLENGTH_SILENCE_SECONDS 5    // silent this long means the end
+
+enum
+{
+    SONGLENGTH_NONE,  // no end or repeat found within the limit
+    SONGLENGTH_END,   // silent from length_ms on
+    SONGLENGTH_LOOP   // state at length_ms equals the one at loop_ms
+};
+
+struct SongLength
+{
+    int kind;
+    uint32_t length_ms;
+    uint32_t loop_ms;
+};
+
+// Hash identifying a tune, independent of its file name
+uint64_t sid_hash(SidFile &sid);
+
+// Play the Sub-Song headless and hash the machine state after every play
+// call; refresh_us is the frame time for tunes not timed by CIA 1
+SongLength analyse_song(SidFile &sid, int song_number, int refresh_us);
+
+// "m:ss.mmm"
+std::string songlength_time(uint32_t ms);
+
+// Text file with one line per Sub-Song:
+// <tune hash> <sub-song from 0> <end|loop|none> <length ms> <loop ms> <file name>
+class SongLengthCache
+{
+private:
+    struct Entry
+    {
+        SongLength length;
+        std::string name;
+    };
+    std::map<std::pair<uint64_t, int>, Entry> entries;
+    std::mutex lock;
+
+public:
+    bool Load(const std::string &path);
+    bool Save(const std::string &path);
+    bool Find(uint64_t hash, int song_number, SongLength &length);
+    void Set(uint64_t hash, int song_number, const SongLength &length, const std::string &name);
+};
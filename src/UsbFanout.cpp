@@ -0,0 +1,146 @@
+//============================================================================
+// Description : SID writes remapped to the SID slots of a USBSID-Pico
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "UsbFanout.h"
+
+UsbFanout::UsbFanout()
+{
+    sid = nullptr;
+}
+
+UsbFanout::~UsbFanout()
+{
+    Close();
+}
+
+bool UsbFanout::Parse(const std::string &map, const uint16_t *sid_addr, int sid_count, std::string &error)
+{
+    routes.clear();
+    char *end;
+    size_t start = 0;
+    while (start <= map.length()) {
+        size_t comma = map.find(',', start);
+        std::string item = map.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = (comma == std::string::npos ? map.length() + 1 : comma + 1);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            error = "expected <sid>=<slot> in '" + item + "'";
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        uint16_t addr;
+        if (key[0] == '$' || key.length() >= 3) {  /* an address */
+            const char *hex = key.c_str() + (key[0] == '$');
+            long value = strtol(hex, &end, 16);
+            if (end == hex || *end != '\0' || value < 0xD400 || value > 0xDFE0) {
+                error = "no SID address in '" + key + "'";
+                return false;
+            }
+            addr = value & 0xFFE0;
+        } else {
+            long sid = strtol(key.c_str(), &end, 10);
+            if (*end != '\0' || sid < 1 || sid > sid_count) {
+                error = "the tune has no SID " + key;
+                return false;
+            }
+            addr = sid_addr[sid - 1];
+        }
+        std::string targets = item.substr(eq + 1);
+        size_t from = 0;
+        while (from <= targets.length()) {
+            size_t plus = targets.find('+', from);
+            std::string target = targets.substr(from, plus == std::string::npos ? std::string::npos : plus - from);
+            long slot = strtol(target.c_str(), &end, 10);
+            if (end == target.c_str() || *end != '\0' || slot < 0 || slot >= FANOUT_SLOTS) {
+                error = "expected a slot below " + std::to_string(FANOUT_SLOTS) + " in '" + item + "'";
+                return false;
+            }
+            routes.push_back({ addr, (uint8_t)slot });
+            from = (plus == std::string::npos ? targets.length() + 1 : plus + 1);
+        }
+    }
+    return true;
+}
+
+void UsbFanout::Submit(void *user, uint8_t *data, size_t size)
+{
+    ((USBSID_NS::USBSID_Class *)user)->USBSID_Write(data, size);
+}
+
+bool UsbFanout::Open(long clock_speed)
+{
+    Close();
+    sid = new USBSID_NS::USBSID_Class();
+    if (sid->USBSID_Init(false, false) < 0) {
+        printf("USBSID-Pico not found\n");
+        delete sid;
+        sid = nullptr;
+        return false;
+    }
+    if (sid->USBSID_GetClockRate() != clock_speed)
+        sid->USBSID_SetClockRate(clock_speed, true);
+    sid->USBSID_Mute();
+    sid->USBSID_ClearBus();
+    sid->USBSID_UnMute();
+    pipeline.Start(Submit, sid);
+    return true;
+}
+
+void UsbFanout::Close()
+{
+    if (!sid) return;
+    pipeline.Stop();
+    delete sid;  /* Executes USBSID_Close() */
+    sid = nullptr;
+}
+
+bool UsbFanout::IsOpen()
+{
+    return sid != nullptr;
+}
+
+void UsbFanout::Write(uint16_t addr, uint8_t value)
+{
+    if (!sid) return;
+    uint16_t base = addr & 0xFFE0;
+    for (const Route &route : routes) {
+        if (route.addr == base)
+            pipeline.Write(route.slot * 0x20 + (addr & 0x1F), value);
+    }
+}
+
+void UsbFanout::EndFrame()
+{
+    if (sid) pipeline.EndFrame();
+}
+
+void UsbFanout::Flush()
+{
+    if (sid) pipeline.Flush();
+}
+
+void UsbFanout::Mute(bool mute)
+{
+    if (!sid) return;
+    Flush();
+    if (mute)
+        sid->USBSID_Mute();
+    else
+        sid->USBSID_UnMute();
+}
+
+const std::vector<UsbFanout::Route> &UsbFanout::GetRoutes()
+{
+    return routes;
+}
+
+void UsbFanout::GetStats(UsbPipeline::Stats &stats)
+{
+    pipeline.GetStats(stats);
+}
@@ -0,0 +1,58 @@
+//============================================================================
+// Description : SID writes remapped to the SID slots of a USBSID-Pico
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <USBSID.h>
+
+#include "UsbPipeline.h"
+
+#define FANOUT_SLOTS 4  // SIDs on the board, at $00 $20 $40 $60
+
+// Routes the writes to 32 byte SID address ranges to SID slots of one
+// USBSID-Pico board; a range can go to several slots to mirror it. The
+// board is written by a UsbPipeline with its own I/O thread. Only one
+// board: USBSID_Init opens the first one it finds and cannot be told
+// which.
+//
+// The map is a comma separated list of <sid>=<slot>, where sid is a SID
+// number of the tune (1 to 4) or a hex address ($D500, D420) for tunes
+// writing to more chips than they declare, and slot 0 to 3; mirror with
+// +, as in 1=0+2.
+class UsbFanout
+{
+public:
+    struct Route
+    {
+        uint16_t addr;  /* 32 bytes from here */
+        uint8_t slot;
+    };
+
+private:
+    USBSID_NS::USBSID_Class *sid;
+    UsbPipeline pipeline;
+    std::vector<Route> routes;
+
+    static void Submit(void *user, uint8_t *data, size_t size);
+
+public:
+    UsbFanout();
+    ~UsbFanout();
+    // sid_addr holds the tune's sid_count SID addresses
+    bool Parse(const std::string &map, const uint16_t *sid_addr, int sid_count, std::string &error);
+    bool Open(long clock_speed);
+    void Close();  /* sends what is queued */
+    bool IsOpen();
+    void Write(uint16_t addr, uint8_t value);
+    void EndFrame();
+    void Flush();
+    void Mute(bool mute);  /* flushes first */
+    const std::vector<Route> &GetRoutes();
+    void GetStats(UsbPipeline::Stats &stats);
+};
@@ -0,0 +1,126 @@
+//============================================================================
+// Description : Frame pipelined, double buffered SID writes to USB
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <cstring>
+
+#include "UsbPipeline.h"
+
+#define WRITE_COMMAND 0x00  /* top two bits of byte 0 */
+
+UsbPipeline::UsbPipeline()
+{
+    pending = running = stopping = false;
+    submit = nullptr;
+    user = nullptr;
+    packetSize = USBPIPE_PACKET;
+    memset(&stats, 0, sizeof(stats));
+}
+
+UsbPipeline::~UsbPipeline()
+{
+    Stop();
+}
+
+void UsbPipeline::Start(Submit submit, void *user, size_t packet_size)
+{
+    Stop();
+    this->submit = submit;
+    this->user = user;
+    packetSize = packet_size < 3 ? 3 : packet_size > USBPIPE_PACKET ? USBPIPE_PACKET : packet_size;
+    filling.clear();
+    flight.clear();
+    pending = stopping = false;
+    memset(&stats, 0, sizeof(stats));
+    started = std::chrono::steady_clock::now();
+    running = true;
+    thread = std::thread(&UsbPipeline::Sender, this);
+}
+
+void UsbPipeline::Stop()
+{
+    if (!running) return;
+    Flush();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+    running = false;
+}
+
+bool UsbPipeline::IsRunning()
+{
+    return running;
+}
+
+void UsbPipeline::Write(uint8_t addr, uint8_t value)
+{
+    filling.push_back(addr);
+    filling.push_back(value);
+}
+
+void UsbPipeline::EndFrame()
+{
+    if (filling.empty()) return;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (pending) {
+            stats.stalls++;
+            done.wait(guard, [this] { return !pending; });
+        }
+        flight.swap(filling);
+        pending = true;
+        stats.frames++;
+    }
+    filling.clear();
+    wake.notify_one();
+}
+
+void UsbPipeline::Flush()
+{
+    if (!running) return;
+    EndFrame();
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return !pending; });
+}
+
+void UsbPipeline::GetStats(Stats &stats)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats = this->stats;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+void UsbPipeline::Sender()
+{
+    uint8_t packet[USBPIPE_PACKET];
+    size_t pairs = (packetSize - 1) / 2;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return pending || stopping; });
+            if (!pending) return;
+        }
+        /* flight is ours until pending is cleared */
+        uint64_t transfers = 0, bytes = 0;
+        for (size_t i = 0; i < flight.size(); i += pairs * 2) {
+            size_t n = flight.size() - i < pairs * 2 ? flight.size() - i : pairs * 2;
+            packet[0] = WRITE_COMMAND | n;
+            memcpy(packet + 1, flight.data() + i, n);
+            submit(user, packet, n + 1);
+            transfers++;
+            bytes += n + 1;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stats.transfers += transfers;
+            stats.bytes += bytes;
+            pending = false;
+        }
+        done.notify_all();
+    }
+}
@@ -0,0 +1,68 @@
+//============================================================================
+// Description : Frame pipelined, double buffered SID writes to USB
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define USBPIPE_PACKET 64  // bulk packet size of the USBSID-Pico
+
+// Collects the register writes of a frame and sends them as bulk
+// transfers from an I/O thread while the next frame is emulated. A
+// transfer is one packet of the firmware's multi write format: byte 0 is
+// the write command (0 in the top two bits) with the number of bytes
+// that follow, then address, value pairs. Two frame buffers: the one
+// being filled and the one in flight, EndFrame waits only when the
+// previous frame has not gone out yet.
+class UsbPipeline
+{
+public:
+    typedef void (*Submit)(void *user, uint8_t *data, size_t size);  /* one bulk transfer */
+
+    struct Stats
+    {
+        uint64_t transfers;
+        uint64_t bytes;    /* sent, headers included */
+        uint64_t frames;
+        uint64_t stalls;   /* frames that waited for the previous one */
+        double seconds;    /* since Start */
+    };
+
+private:
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::thread thread;
+    std::vector<uint8_t> filling;  /* address, value pairs */
+    std::vector<uint8_t> flight;
+    bool pending;      /* flight holds a frame not sent yet */
+    bool running;
+    bool stopping;
+    Submit submit;
+    void *user;
+    size_t packetSize;
+    Stats stats;
+    std::chrono::steady_clock::time_point started;
+
+    void Sender();
+
+public:
+    UsbPipeline();
+    ~UsbPipeline();
+    void Start(Submit submit, void *user, size_t packet_size = USBPIPE_PACKET);
+    void Stop();  /* sends what is left */
+    bool IsRunning();
+    void Write(uint8_t addr, uint8_t value);
+    // hand the frame to the I/O thread
+    void EndFrame();
+    // EndFrame and wait until everything is sent, before other device calls
+    void Flush();
+    void GetStats(Stats &stats);
+};
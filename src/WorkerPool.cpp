@@ -0,0 +1,74 @@
+//============================================================================
+// Description : Fixed size pool of worker threads
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int count)
+{
+    busy = 0;
+    stopping = false;
+    if (count == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        count = cores > 1 ? cores - 1 : 1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        threads.emplace_back(&WorkerPool::Worker, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        jobs.clear();
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+void WorkerPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void WorkerPool::Wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this] { return jobs.empty() && busy == 0; });
+}
+
+unsigned int WorkerPool::GetThreadCount()
+{
+    return threads.size();
+}
+
+void WorkerPool::Worker()
+{
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            busy++;
+        }
+        job();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy--;
+        }
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,36 @@
+//============================================================================
+// Description : Fixed size pool of worker threads
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs queued jobs on a fixed number of threads. The destructor drops
+// jobs that did not start yet and waits for the running ones.
+class WorkerPool
+{
+private:
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> threads;
+    unsigned int busy;  /* jobs running */
+    bool stopping;
+
+    void Worker();
+
+public:
+    WorkerPool(unsigned int count = 0);  /* 0: one less than the number of cores */
+    ~WorkerPool();
+    void Submit(std::function<void()> job);
+    void Wait();  /* until all submitted jobs are done */
+    unsigned int GetThreadCount();
+};
@@ -0,0 +1,323 @@
+//============================================================================
+// Description : Microbenchmarks for the mos6502 core
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// Output is CSV on stdout, one line per result, always in the same order:
+//   kind,name,config,cycles,seconds,mcycles_per_s
+// kind "mix" is a synthetic instruction mix run in three core
+// configurations, kind "play" is a real play routine run in a SidMachine.
+// seconds is the best of the repeats.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mos6502/mos6502.h"
+#include "SidFile.h"
+#include "SidMachine.h"
+
+#define BENCH_VERSION 1
+#define MIX_ORIGIN 0x1000
+
+static uint8_t memory[65536];
+
+static uint8_t BusRead(uint16_t addr)
+{
+    return memory[addr];
+}
+
+static void BusWrite(uint16_t addr, uint8_t byte)
+{
+    memory[addr] = byte;
+}
+
+struct Mix
+{
+    const char *name;
+    std::vector<uint8_t> code;  /* loaded at MIX_ORIGIN, loops forever */
+};
+
+static const Mix mixes[] = {
+    { "alu", {
+        0x18,             // 1000 CLC
+        0xA9, 0x00,       // 1001 LDA #$00
+        0xA2, 0x10,       // 1003 LDX #$10
+        0xA0, 0x20,       // 1005 LDY #$20
+        0x69, 0x37,       // 1007 ADC #$37
+        0x49, 0x5A,       // 1009 EOR #$5A
+        0x29, 0xF7,       // 100B AND #$F7
+        0x09, 0x11,       // 100D ORA #$11
+        0x2A,             // 100F ROL A
+        0xE9, 0x03,       // 1010 SBC #$03
+        0x4A,             // 1012 LSR A
+        0xC9, 0x40,       // 1013 CMP #$40
+        0xE8,             // 1015 INX
+        0x88,             // 1016 DEY
+        0x4C, 0x07, 0x10, // 1017 JMP $1007
+    } },
+    { "memory", {
+        0xA0, 0x00,       // 1000 LDY #$00
+        0xA2, 0x00,       // 1002 LDX #$00
+        0xBD, 0x00, 0x20, // 1004 LDA $2000,X
+        0x9D, 0x00, 0x30, // 1007 STA $3000,X
+        0xB1, 0xFB,       // 100A LDA ($FB),Y
+        0x91, 0xFD,       // 100C STA ($FD),Y
+        0xFE, 0x00, 0x06, // 100E INC $0600,X
+        0xB5, 0x40,       // 1011 LDA $40,X
+        0x99, 0x00, 0x40, // 1013 STA $4000,Y
+        0xE8,             // 1016 INX
+        0xC8,             // 1017 INY
+        0x4C, 0x04, 0x10, // 1018 JMP $1004
+    } },
+    { "branch", {
+        0xA2, 0x00,       // 1000 LDX #$00
+        0xA0, 0x00,       // 1002 LDY #$00
+        0xE8,             // 1004 INX
+        0x8A,             // 1005 TXA
+        0x4A,             // 1006 LSR A
+        0x90, 0x02,       // 1007 BCC $100B
+        0xC8,             // 1009 INY
+        0xC8,             // 100A INY
+        0x4A,             // 100B LSR A
+        0xB0, 0x01,       // 100C BCS $100F
+        0x88,             // 100E DEY
+        0xC0, 0x80,       // 100F CPY #$80
+        0x30, 0x02,       // 1011 BMI $1015
+        0xA0, 0x00,       // 1013 LDY #$00
+        0xE0, 0x00,       // 1015 CPX #$00
+        0xD0, 0xEB,       // 1017 BNE $1004
+        0x4C, 0x04, 0x10, // 1019 JMP $1004
+    } },
+    { "stack", {
+        0xA2, 0xFF,       // 1000 LDX #$FF
+        0x9A,             // 1002 TXS
+        0x20, 0x10, 0x10, // 1003 JSR $1010
+        0x48,             // 1006 PHA
+        0x08,             // 1007 PHP
+        0x28,             // 1008 PLP
+        0x68,             // 1009 PLA
+        0x4C, 0x03, 0x10, // 100A JMP $1003
+        0x00, 0x00, 0x00,
+        0x48,             // 1010 PHA
+        0x8A,             // 1011 TXA
+        0x48,             // 1012 PHA
+        0x98,             // 1013 TYA
+        0x48,             // 1014 PHA
+        0x68,             // 1015 PLA
+        0xA8,             // 1016 TAY
+        0x68,             // 1017 PLA
+        0xAA,             // 1018 TAX
+        0x68,             // 1019 PLA
+        0xE8,             // 101A INX
+        0x60,             // 101B RTS
+    } },
+};
+
+enum MixConfig
+{
+    CONFIG_BUS,     /* every access through the bus callbacks */
+    CONFIG_DIRECT,  /* RAM pages direct */
+    CONFIG_CACHED,  /* RAM pages direct and the block cache */
+};
+static const char *configNames[] = { "bus", "direct", "cached" };
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void print_result(const char *kind, std::string name, const char *config, uint64_t cycles, double seconds)
+{
+    std::replace(name.begin(), name.end(), ',', '_');
+    printf("%s,%s,%s,%llu,%.6f,%.2f\n", kind, name.c_str(), config, (unsigned long long)cycles, seconds,
+           seconds > 0 ? cycles / seconds / 1e6 : 0.0);
+    fflush(stdout);
+}
+
+static void bench_mix(const Mix &mix, MixConfig config, uint64_t cycles, int repeats)
+{
+    double best = 0;
+    uint64_t ran = 0;
+
+    for (int r = 0; r < repeats; r++)
+    {
+        memset(memory, 0, sizeof(memory));
+        for (size_t i = 0; i < mix.code.size(); i++)
+        {
+            memory[MIX_ORIGIN + i] = mix.code[i];
+        }
+        for (int i = 0; i < 256; i++)
+        {
+            memory[0x2000 + i] = i * 7;
+        }
+        memory[0xFB] = 0x00; memory[0xFC] = 0x20;  /* ($FB) = $2000 */
+        memory[0xFD] = 0x00; memory[0xFE] = 0x50;  /* ($FD) = $5000 */
+        memory[0xFFFC] = MIX_ORIGIN & 0xFF;
+        memory[0xFFFD] = MIX_ORIGIN >> 8;
+
+        std::unique_ptr<mos6502> cpu(new mos6502(BusRead, BusWrite));
+        if (config != CONFIG_BUS)
+        {
+            cpu->SetRAM(memory);
+            cpu->SetPageFlags(0x00, 0xFF, mos6502::PAGE_DIRECT);
+        }
+        cpu->SetBlockCache(config == CONFIG_CACHED);
+        cpu->SetIdleSkip(false);  /* the ALU loop has no side effects */
+        cpu->Reset();
+
+        uint64_t count = 0;
+        double start = now();
+        while (count < cycles)
+        {
+            uint64_t before = count;
+            cpu->Run(1000000, count);
+            if (count == before) break;  /* illegal opcode, a broken mix */
+        }
+        double seconds = now() - start;
+        if (r == 0 || seconds < best)
+        {
+            best = seconds;
+            ran = count;
+        }
+    }
+    print_result("mix", mix.name, configNames[config], ran, best);
+}
+
+static void bench_play(const std::string &file, int frames, int repeats)
+{
+    SidFile sid;
+    if (sid.Parse(file) != SIDFILE_OK)
+    {
+        fprintf(stderr, "error loading sid file %s\n", file.c_str());
+        return;
+    }
+    std::unique_ptr<SidMachine> machine(new SidMachine);
+    double best = 0;
+    uint64_t ran = 0;
+
+    for (int r = 0; r < repeats; r++)
+    {
+        machine->Load(sid, sid.GetFirstSong());
+        uint64_t start_cycles = machine->GetCycles();
+        double start = now();
+        for (int f = 0; f < frames; f++)
+        {
+            if (!machine->Play()) break;  /* stuck, counted up to here */
+        }
+        double seconds = now() - start;
+        if (r == 0 || seconds < best)
+        {
+            best = seconds;
+            ran = machine->GetCycles() - start_cycles;
+        }
+    }
+    print_result("play", std::filesystem::path(file).filename().string(), "machine", ran, best);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: sidberry_bench [options] [sidfile|folder ...]\n");
+    fprintf(stderr, "Runs the synthetic mixes, then the play routines of the given Sid Files (default sidfiles)\n");
+    fprintf(stderr, "-c, --cycles <n>  : Cycles per synthetic mix (default 50000000)\n");
+    fprintf(stderr, "-f, --frames <n>  : Play calls per Sid File (default 3000)\n");
+    fprintf(stderr, "-r, --repeat <n>  : Repeats, the best time is reported (default 5)\n");
+    fprintf(stderr, "-m, --mix-only    : Skip the play routines\n");
+    fprintf(stderr, "-h, --help        : Show this help message\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t cycles = 50000000;
+    int frames = 3000;
+    int repeats = 5;
+    bool mix_only = false;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if ((arg == "-c" || arg == "--cycles") && i + 1 < argc)
+        {
+            cycles = strtoull(argv[++i], nullptr, 10);
+        }
+        else if ((arg == "-f" || arg == "--frames") && i + 1 < argc)
+        {
+            frames = atoi(argv[++i]);
+        }
+        else if ((arg == "-r" || arg == "--repeat") && i + 1 < argc)
+        {
+            repeats = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "-m" || arg == "--mix-only")
+        {
+            mix_only = true;
+        }
+        else if (arg == "-h" || arg == "--help")
+        {
+            usage();
+            return 0;
+        }
+        else if (arg[0] == '-')
+        {
+            usage();
+            return 1;
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+    if (args.empty())
+    {
+        args.push_back("sidfiles");
+    }
+
+    std::vector<std::string> files;
+    for (std::string &arg : args)
+    {
+        std::error_code ec;
+        if (std::filesystem::is_directory(arg, ec))
+        {
+            std::vector<std::string> found;
+            for (auto &entry : std::filesystem::directory_iterator(arg, ec))
+            {
+                std::string ext = entry.path().extension().string();
+                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                if (entry.is_regular_file() && ext == ".sid")
+                    found.push_back(entry.path().string());
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        else
+        {
+            files.push_back(arg);
+        }
+    }
+
+    printf("# sidberry_bench %d\n", BENCH_VERSION);
+    printf("kind,name,config,cycles,seconds,mcycles_per_s\n");
+    for (const Mix &mix : mixes)
+    {
+        for (int config = CONFIG_BUS; config <= CONFIG_CACHED; config++)
+        {
+            bench_mix(mix, (MixConfig)config, cycles, repeats);
+        }
+    }
+    if (!mix_only)
+    {
+        for (std::string &file : files)
+        {
+            bench_play(file, frames, repeats);
+        }
+    }
+    return 0;
+}
@@ -25,11 +25,32 @@
 
 #include "mos6502/mos6502.h"
 #include "SidFile.h"
+#include "SidDump.h"
+#include "SidEmu.h"
+#include "SidLog.h"
+#include "SidMachine.h"
+#include "SongLength.h"
+#include "UsbFanout.h"
+#include "UsbPipeline.h"
+#include "WorkerPool.h"
 #include "sidberry.h"
 
 #pragma GCC diagnostic ignored "-Wnarrowing"
 
 uint8_t memory[65536];         // init 64K ram
+PagePool page_pool;            // memory pages of all snapshots
+std::vector<std::unique_ptr<SidSnapshot>> snapshots;  // post-init state per Sub-Song
+std::mutex snapshot_lock;      // snapshots are also filled by init_pool
+std::unique_ptr<WorkerPool> init_pool;  // runs the init of every Sub-Song in the background
+RewindRing rewind_ring(8 << 20);  // snapshots while playing, for seeking back
+uint32_t rewind_interval = 0;  // frames between rewind snapshots, 0 = off
+uint32_t song_frames = 0;      // play calls since the Sub-Song's init
+string songlength_cache = "songlengths.txt";  // written by --analyse
+SidLogWriter sid_log;          // --record, open while recording
+string record_file = "";
+bool record_entropy = true;    // range code packed logs, off with --no-entropy
+string wav_file = "";          // --wav, render with the software SID
+uint32_t wav_rate = 44100;
 int sidcount = 1;              // default to 1 sid
 int sidno;
 int fmoplsidno = -1;
@@ -51,6 +72,13 @@ bool use_cycles = false;       // add cycles to writes
 bool use_asid = false;         // use ASID to write to USBSID-Pico (or other ASID supporting devices)
 bool use_serial = false;       // use direct serial connection to write to USBSID-Pico
 bool use_usbsid = false;       // use USB to write to USBSID-Pico
+bool sync_writes = false;      // write every register to USBSID-Pico at once instead of per frame
+UsbPipeline usb_pipeline;      // the frame's writes, sent while the next frame is emulated
+bool use_fanout = false;       // write to the USBSID-Pico SID slots fanout_map says
+string fanout_map;             // --fanout argument
+UsbFanout fanout;              // the board, with its own I/O thread
+bool seeking = false;          // fast-forwarding, keep SID writes in memory only
+int play_rate = 0;             // microseconds between play calls
 
 /* Serial stuffs */
 #if defined(UNIX_COMPILE)
@@ -63,7 +91,10 @@ int us_Out, serial_port;
 bool calculatedclock = false;  // init calculated clock speed boolean
 bool calculatedhz = false;     // init calculated refresh boolean
 volatile sig_atomic_t stop;    // init variable for ctrl+c
-bool real_read = true;         // use actual pin reading when USBSID-Pico
+bool real_read = false;        // read OSC3/ENV3 from the USBSID-Pico instead of the voice 3 model
+int read_resync = 0;           // frames between voice 3 model resyncs from the USBSID-Pico, 0 is never
+SidChip read_model[SIDLOG_MAX_SIDS];          // answers the OSC3/ENV3 reads of each SID
+uint64_t read_model_cycles[SIDLOG_MAX_SIDS];  // cyclecount the models are at
 timeval t1, t2, t3, t4, c1, c2;
 long int elaps;
 
@@ -81,15 +112,49 @@ int asid_flush(void);
 int serial_write_chars(unsigned char * data, size_t size);
 #endif
 
+void usb_submit(void *user, uint8_t *data, size_t size)
+{
+    us_sid->USBSID_Write(data, size);
+}
+
+void usb_report(void)
+{
+    UsbPipeline::Stats s;
+    usb_pipeline.GetStats(s);
+    if (s.frames == 0 || s.seconds <= 0) return;
+    printf("USB: %llu transfers in %.1f s, %.1f/s, %.1f bytes average, %llu frames, %llu waited for the previous\n",
+           (unsigned long long)s.transfers, s.seconds, s.transfers / s.seconds,
+           s.transfers ? (double)s.bytes / s.transfers : 0.0, (unsigned long long)s.frames, (unsigned long long)s.stalls);
+}
+
+void fanout_report(void)
+{
+    UsbPipeline::Stats s;
+    fanout.GetStats(s);
+    if (s.frames == 0 || s.seconds <= 0) return;
+    printf("USB: %llu transfers in %.1f s, %.1f/s, %.1f bytes average, %llu frames, %llu waited for the previous\n",
+           (unsigned long long)s.transfers, s.seconds, s.transfers / s.seconds,
+           s.transfers ? (double)s.bytes / s.transfers : 0.0, (unsigned long long)s.frames, (unsigned long long)s.stalls);
+}
+
 void exitPlayer(void)
 {
     fprintf(stdout, "\n** Exit **\n");
+    if (usb_pipeline.IsRunning()) {
+        usb_pipeline.Stop();  /* the writes below go out directly */
+        usb_report();
+    }
     for (int j = 0; j < sidcount; j++) {
         for (int i = 0xD400; i < 0xD418; i++) {
             MemWrite((i + (j * 0x20)), 0);
         }
     }
     if (use_usbsid) delete us_sid;  /* Executes us_sid->USBSID_Close(); */
+    if (fanout.IsOpen()) {
+        fanout.Flush();  /* the writes above */
+        fanout_report();
+        fanout.Close();
+    }
     if (use_asid) asid_close();
     #if defined(UNIX_COMPILE)
     if (use_serial) {
@@ -103,7 +168,8 @@ void exitPlayer(void)
 void inthand(int signum)
 {
     stop = 1;
-    exitPlayer();
+    if (!usb_pipeline.IsRunning() && !fanout.IsOpen())  /* else the player loop exits, locks are not for signal handlers */
+        exitPlayer();
 }
 
 #if defined(UNIX_COMPILE)
@@ -258,18 +324,67 @@ uint8_t addr_translation(uint16_t addr)
 uint16_t last_raddr, last_waddr;
 uint8_t last_byte;
 
+int read_model_chip(uint16_t addr)
+{
+    const uint16_t base[4] = { sidone, sidtwo, sidthree, sidfour };
+    for (int j = 0; j < sidcount && j < SIDLOG_MAX_SIDS; j++) {
+        if ((uint16_t)(addr - base[j]) < 0x20) return j;
+    }
+    return -1;
+}
+
+SidChip &read_model_at(int chip)
+{
+    SidChip &model = read_model[chip];
+    if (cyclecount > read_model_cycles[chip])  /* a restored snapshot goes back */
+        model.Clock(cyclecount - read_model_cycles[chip]);
+    read_model_cycles[chip] = cyclecount;
+    return model;
+}
+
+void read_model_reset(SidFile &sid)
+{
+    for (int j = 0; j < SIDLOG_MAX_SIDS; j++) {
+        read_model[j].Reset(sidemu_model(sid.GetChipType(j < 3 ? j + 1 : 3)), 44100);  /* as sidlog_header */
+        read_model_cycles[j] = cyclecount;
+    }
+}
+
+void read_model_resync(void)
+{
+    if (!use_usbsid || use_cycles) return;  /* Cannot use reading with buffer & cycles */
+    usb_pipeline.Flush();
+    const uint16_t base[4] = { sidone, sidtwo, sidthree, sidfour };
+    for (int j = 0; j < sidcount && j < SIDLOG_MAX_SIDS; j++) {
+        unsigned char osc3[3] = { 0x1, (uint8_t)(addr_translation(base[j] + 0x1B) & 0xFF), 0x0 };
+        unsigned char env3[3] = { 0x1, (uint8_t)(addr_translation(base[j] + 0x1C) & 0xFF), 0x0 };
+        read_model_at(j).Resync(us_sid->USBSID_Read(osc3), us_sid->USBSID_Read(env3));
+    }
+}
+
 void MemWrite(uint16_t addr, uint8_t byte)
 {
+    if (sid_io_address(addr))
+    { /* the read models hear every write, muted or not */
+        int chip = read_model_chip(addr);
+        if (chip >= 0) read_model_at(chip).Write(addr & 0x1F, byte);
+    }
+    if (seeking)
+    { /* muted, push_sid_registers() sends the end result */
+        memory[addr] = byte;
+        return;
+    }
     last_waddr = addr;
     last_byte = byte;
     gettimeofday(&c1, NULL);
-    if (addr >= 0xD400 && addr <= 0xD5FF || addr >= 0xDE00 && addr <= 0xDFFF)
+    if (sid_io_address(addr))
     {
         // gettimeofday(&v2, NULL);
         // prevval = v2.tv_usec - v1.tv_usec;
         // printf("uS since last SIDwrite = %lld\n", prevval);
         // access to SID chip
         memory[addr] = byte;
+        if (sid_log.IsOpen() && !stop) sid_log.Write(cyclecount, addr, byte);  /* not from inthand */
 
         if (verbose && !trace)
         {
@@ -283,7 +398,11 @@ void MemWrite(uint16_t addr, uint8_t byte)
 
         uint8_t phyaddr = addr_translation(addr) & 0xFF;  /* 4 SIDs max */
         unsigned char buff[3] = { 0x0, phyaddr, byte };   /* 3 Byte buffer */
-        if (use_usbsid && !use_cycles) us_sid->USBSID_Write(buff, 3);
+        if (use_usbsid && !use_cycles) {
+            if (usb_pipeline.IsRunning()) usb_pipeline.Write(phyaddr, byte);
+            else us_sid->USBSID_Write(buff, 3);
+        }
+        if (use_fanout) fanout.Write(addr, byte);  /* the SID address, the map picks board and slot */
         if (use_usbsid && use_cycles) us_sid->USBSID_WriteRingCycled(phyaddr, byte, (cyclecount - last_sidwr_cyclecount));
         // if (use_usbsid && use_cycles) us_sid->USBSID_WriteRingCycled(phyaddr, byte, (c1.tv_usec - c2.tv_usec) + 6);  /* 6 cycles */
         // if (use_usbsid) us_sid->USBSID_WriteRing(phyaddr, byte);
@@ -326,52 +445,36 @@ uint8_t MemRead(uint16_t addr)
 {
     last_raddr = addr;
     /* printf("[R]$%04x $%02x\r\n", addr, memory[addr]); */
-    if (addr >= 0xD400 && addr <= 0xDFFF) // address decoding logic
+    if (sid_voice3_read(addr)) // address decoding logic
     {
-        if (real_read == false)  // default
+        // Songs like Cantina_Band.sid from HVSC DEMOS use this!
+        // access to SID chip
+        if (!real_read || seeking || !use_usbsid || use_cycles)  /* no device access while fast-forwarding */
         {
-            // Songs like Cantina_Band.sid from HVSC DEMOS use this!
-            // access to SID chip
-            if ((addr & 0x00FF) == 0x001B)
-            {
-                // emulate read access to OSC3/Random register, return a random value
-                printf("\nread! 1b");
-                return rand();
-            }
-            if ((addr & 0x00FF) == 0x001C)
-            {
-                // emulate access to envelope ENV3 register, return a random value
-                printf("\nread! 1c");
-                return rand();
-            }
+            // emulate read access to OSC3/ENV3 with the voice 3 model, a lone SID is mirrored
+            int chip = read_model_chip(addr);
+            return read_model_at(chip < 0 ? 0 : chip).Read(addr & 0x1F);
         } else
         {
-            // Songs like Cantina_Band.sid from HVSC DEMOS use this!
-            // access to SID chip
-            if ((addr & 0x001F) == 0x001B || (addr & 0x001F) == 0x001C)
+            /* USBSID code */
+            uint8_t phyaddr = addr_translation(addr) & 0xFF;  /* 4 SIDs max */
+            unsigned char buff[3] = { 0x1, phyaddr, 0x0 };   /* 3 Byte buffer */
+            usb_pipeline.Flush();  /* the writes before the read first */
+            uint8_t result = us_sid->USBSID_Read(buff);  /* Cannot use reading with buffer & cycles */
+            if (verbose && trace)
             {
-                /* USBSID code */
-                uint8_t phyaddr = addr_translation(addr) & 0xFF;  /* 4 SIDs max */
-                unsigned char buff[3] = { 0x1, phyaddr, 0x0 };   /* 3 Byte buffer */
-                uint8_t result;
-                if (use_usbsid && !use_cycles) result = us_sid->USBSID_Read(buff);  /* Cannot use reading with buffer & cycles */
-                else result = 0;
-                if (verbose && trace)
-                {
-                    fprintf(stdout, "[%d][R]@%02x [D]%02x\n", sidno, phyaddr, result);
-                }
-                return result;
+                fprintf(stdout, "[%d][R]@%02x [D]%02x\n", sidno, phyaddr, result);
             }
+            return result;
         }
     }
     return memory[addr];
 }
 
-void CycleFn(mos6502* cpu)
+void CycleFn(mos6502* cpu, uint32_t cycles)
 {
-    if(!debug) return;
-    printf("[C]%4u [PC]%04X [S]%02X [P]%02X [A]%02X [X]%02X [Y]%02X [W]%04X:%02X [R]%04X\n",
-        cyclecount,
+    printf("[C]%4u +%u [PC]%04X [S]%02X [P]%02X [A]%02X [X]%02X [Y]%02X [W]%04X:%02X [R]%04X\n",
+        cyclecount, cycles,
         cpu->GetPC(),
         cpu->GetS(),
         cpu->GetP(),
@@ -384,61 +487,143 @@ void CycleFn(mos6502* cpu)
     return;
 }
 
-int load_sid(mos6502 cpu, SidFile sid, int song_number)
+void push_sid_registers(void)
 {
-    // gettimeofday(&v1, NULL);
-    for (unsigned int i = 0; i < 65536; i++)
+    const uint16_t base[4] = { sidone, sidtwo, sidthree, sidfour };
+    for (int j = 0; j < sidcount; j++) {
+        for (int i = 0; i <= 0x18; i++) {  /* 0x19-0x1C are read only */
+            MemWrite(base[j] + i, memory[base[j] + i]);
+        }
+    }
+}
+
+void save_snapshot(mos6502 &cpu, SidSnapshot &snap)
+{
+    snap.Save(cpu, cyclecount, memory, page_pool);
+}
+
+void restore_snapshot(mos6502 &cpu, const SidSnapshot &snap)
+{
+    snap.Restore(cpu, cyclecount, memory);
+    last_write_cyclecount = last_sidwr_cyclecount = cyclecount;
+    push_sid_registers();
+}
+
+void preinit_subtunes(SidFile &sid, int song_number)
+{
+    int songs = sid.GetNumOfSongs();
+    if (songs < 2) return;
     {
-        memory[i] = 0x00; // fill with NOPs
+        std::lock_guard<std::mutex> guard(snapshot_lock);
+        if (snapshots.size() < (size_t)songs)
+            snapshots.resize(songs);
+    }
+    init_pool.reset(new WorkerPool());
+    for (int i = 1; i < songs; i++) {
+        /* next, previous, second next, ... Sub-Song first */
+        int song = (song_number + ((i & 1) ? (i + 1) / 2 : songs - i / 2)) % songs;
+        init_pool->Submit([&sid, song] {
+            {
+                std::lock_guard<std::mutex> guard(snapshot_lock);
+                if (snapshots[song]) return;
+            }
+            std::unique_ptr<SidMachine> machine(new SidMachine);
+            std::unique_ptr<SidSnapshot> snap(new SidSnapshot);
+            machine->Load(sid, song);
+            machine->Save(*snap, page_pool);
+            std::lock_guard<std::mutex> guard(snapshot_lock);
+            if (!snapshots[song])
+                snapshots[song] = std::move(snap);
+        });
     }
+}
+
+int load_sid(mos6502 &cpu, SidFile &sid, int song_number)
+{
+    song_frames = 0;
+    rewind_ring.Clear();
 
-    uint16_t load = sid.GetLoadAddress();
-    uint16_t len = sid.GetDataLength();
-    uint8_t *buffer = sid.GetDataPtr();
-    for (unsigned int i = 0; i < len; i++)
+    SidSnapshot *ready = nullptr;  /* set entries are never replaced */
     {
-        memory[i + load] = buffer[i];
+        std::lock_guard<std::mutex> guard(snapshot_lock);
+        if ((size_t)song_number < snapshots.size())
+            ready = snapshots[song_number].get();
+    }
+    if (ready)
+    { /* init already ran once, continue from where it ended */
+        restore_snapshot(cpu, *ready);
+        return 0;
     }
 
-    uint16_t play = sid.GetPlayAddress();
-    uint16_t init = sid.GetInitAddress();
+    // gettimeofday(&v1, NULL);
+    install_microplayer(memory, sid, song_number);
 
-    // install reset vector for microplayer (0x0000)
-    memory[0xFFFD] = 0x00;
-    memory[0xFFFC] = 0x00;
+    cpu.InvalidateCode();
+    cpu.Reset();
+    cpu.RunN(CLOCK_CYCLES, cyclecount); // 100000 clockcycles
+    if (debug) printf("[IDLE] %llu cycles skipped\n", cpu.GetIdleCycles());
+    // cpu.Run(CLOCK_CYCLES, cyclecount, cpu.CYCLE_COUNT); // 100000 clockcycles
 
-    // install IRQ vector for play routine launcher (0x0013)
-    memory[0xFFFF] = 0x00;
-    memory[0xFFFE] = 0x13;
+    std::unique_ptr<SidSnapshot> snap(new SidSnapshot);
+    save_snapshot(cpu, *snap);
+    std::lock_guard<std::mutex> guard(snapshot_lock);
+    if (snapshots.size() < (size_t)sid.GetNumOfSongs())
+        snapshots.resize(sid.GetNumOfSongs());
+    if (!snapshots[song_number])
+        snapshots[song_number] = std::move(snap);
+    return 0;
+}
 
-    // install the micro player, 6502 assembly code
+void play_frame(mos6502 &cpu)
+{
+    if (!seeking && sid_log.IsOpen()) sid_log.BeginFrame(cyclecount);
 
-    memory[0x0000] = 0xA9; // A = 0, load A with the song number
-    memory[0x0001] = song_number;
+    // trigger IRQ interrupt
+    cpu.IRQ();
 
-    memory[0x0002] = 0x20;               // jump sub to INIT routine
-    memory[0x0003] = init & 0xFF;        // lo addr
-    memory[0x0004] = (init >> 8) & 0xFF; // hi addr
+    // execute the player routine
+    cpu.RunN(0, cyclecount);
+    // cpu.Run(1, cyclecount, cpu.CYCLE_COUNT); // 100000 clockcycles
 
-    memory[0x0005] = 0x58; // enable interrupt
-    memory[0x0006] = 0xEA; // nop
-    memory[0x0007] = 0x4C; // jump to 0x0006
-    memory[0x0008] = 0x06;
-    memory[0x0009] = 0x00;
+    song_frames++;
+    if (rewind_interval && (song_frames % rewind_interval) == 0)
+        rewind_ring.Push(cpu, cyclecount, memory, song_frames);
+}
 
-    memory[0x0013] = 0xEA; // nop  //0xA9; // A = 1
-    memory[0x0014] = 0xEA; // nop //0x01;
-    memory[0x0015] = 0xEA; // 0x78 CLI
-    memory[0x0016] = 0x20; // jump sub to play routine
-    memory[0x0017] = play & 0xFF;
-    memory[0x0018] = (play >> 8) & 0xFF;
-    memory[0x0019] = 0xEA; // 0x58 SEI
-    memory[0x001A] = 0x40; // RTI: return from interrupt
+void seek_song(mos6502 &cpu, SidFile &sid, int song_number, int target, int *sec, int *min)
+{
+    uint64_t rate = (play_rate > 0 ? play_rate : HERTZ_DEFAULT);
+    if (target < 0) target = 0;
+    uint32_t target_frame = (uint64_t)target * 1000000 / rate;
+
+    seeking = true;
+    if (target_frame < song_frames)
+    { /* the player only runs forward, start over from an earlier snapshot */
+        uint32_t restored;
+        if (rewind_ring.Restore(target_frame, cpu, cyclecount, memory, restored))
+            song_frames = restored;
+        else
+            load_sid(cpu, sid, song_number);
+    }
+    int shown = -1;
+    while (song_frames < target_frame && !stop)
+    { /* one frame per pass, the status once per second */
+        int s = (uint64_t)song_frames * rate / 1000000;
+        if (s != shown)
+        {
+            shown = s;
+            printf("\rSeek Sub-Song %d / %d [%02d:%02d] -> [%02d:%02d]      ", song_number + 1, sid.GetNumOfSongs(), s / 60, s % 60, target / 60, target % 60);
+            fflush(stdout);
+        }
+        play_frame(cpu);
+    }
+    seeking = false;
+    if (stop) return;  /* Ctrl-C, inthand has shut the outputs */
 
-    cpu.Reset();
-    cpu.RunN(CLOCK_CYCLES, cyclecount); // 100000 clockcycles
-    // cpu.Run(CLOCK_CYCLES, cyclecount, cpu.CYCLE_COUNT); // 100000 clockcycles
-    return 0;
+    last_write_cyclecount = last_sidwr_cyclecount = cyclecount;
+    push_sid_registers();
+    *min = target / 60;
+    *sec = target % 60;
 }
 
 int getch_noecho_special_char(void)
@@ -490,7 +675,7 @@ int getch_noecho_special_char(void)
     #endif
 }
 
-void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused, bool *exit, uint8_t *mode_vol_reg, int *song_number, int *sec, int *min)
+void change_player_status(mos6502 &cpu, SidFile &sid, int key_press, bool *paused, bool *exit, uint8_t *mode_vol_reg, int *song_number, int *sec, int *min)
 {
 
     if (key_press == 256 || key_press == (int)'q')
@@ -508,7 +693,9 @@ void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused,
             for (int i = 0; i < sidcount; i++) {
                 MemWrite((VOL_ADDR + (i * 0x20)), *mode_vol_reg);
             }
+            usb_pipeline.Flush();
             if (use_usbsid) us_sid->USBSID_UnMute();
+            if (use_fanout) fanout.Mute(false);
             *paused = false;
         }
         else
@@ -518,7 +705,9 @@ void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused,
             for (int i = 0; i < sidcount; i++) {
                 MemWrite((VOL_ADDR + (i * 0x20)), 0);
             }
+            usb_pipeline.Flush();
             if (use_usbsid) us_sid->USBSID_Mute();
+            if (use_fanout) fanout.Mute(true);
             *paused = true;
         }
     }
@@ -547,6 +736,7 @@ void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused,
         if (use_usbsid) {
             if (pcbversion == 13) {
                 if (*paused) {
+                    usb_pipeline.Flush();
                     us_sid->USBSID_ToggleStereo();
                 } else {
                     fprintf(stdout, "PRESS PAUSE FIRST!\n");
@@ -571,6 +761,13 @@ void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused,
         printf("\rPlay Sub-Song %d / %d [%02d:%02d] @ Volume: %d            ", (*song_number) + 1, sid.GetNumOfSongs(), *min, *sec, volume);
         fflush(stdout);
     }
+    else if (key_press == (int)'f' || key_press == (int)'b')
+    { // Seek 10 seconds forward / back
+        int target = (*min * 60) + *sec + (key_press == (int)'f' ? 10 : -10);
+        seek_song(cpu, sid, *song_number, target, sec, min);
+        printf("\rPlay Sub-Song %d / %d [%02d:%02d] @ Volume: %d%s", (*song_number) + 1, sid.GetNumOfSongs(), *min, *sec, volume, (*paused ? " [PAUSED]    " : "            "));
+        fflush(stdout);
+    }
     else if (key_press == 257)
     { // Previous Sub-Song
         (*song_number)--;
@@ -610,153 +807,1087 @@ void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused,
     }
 }
 
-void USBSIDSetup(void)
+/* Sid Files listed in a playlist, one per line relative to it; # starts a comment */
+static bool read_playlist(const string &name, vector<string> &found)
 {
-    USBSID_NS::USBSID_Class* us_sid = new USBSID_NS::USBSID_Class();
-    if (use_usbsid && !use_cycles) {
-        printf("Opening USBSID-Pico\n");
-        if (us_sid->USBSID_Init(false, false) < 0) {
-            printf("USBSID-Pico not found, exiting...\n");
-            exit(1);
-        }
-    }
-    if (use_usbsid && use_cycles) {
-        printf("Opening USBSID-Pico with buffer for cycle exact writing\n");
-        if (us_sid->USBSID_Init(true, true) < 0) {
-            printf("USBSID-Pico not found, exiting...\n");
-            exit(1);
-        }
+    std::ifstream list(name);
+    if (!list) return false;
+    std::filesystem::path base = std::filesystem::path(name).parent_path();
+    string line;
+    while (std::getline(list, line))
+    {
+        while (line.length() && isspace((unsigned char)line.back()))
+            line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        std::filesystem::path entry(line);
+        found.push_back((entry.is_absolute() ? entry : base / entry).string());
     }
-    /* Sleep 400ms for Reset to settle */
-    struct timespec tv = { .tv_sec = 0, .tv_nsec = (400 * 1000 * 1000) };
-    nanosleep(&tv, &tv);
-    #ifndef NO_REBOOT
-    us_sid->USBSID_Mute();
-    us_sid->USBSID_ClearBus();
-    us_sid->USBSID_UnMute();
-    #endif
+    return true;
 }
 
-char * midi_port;
-int main(int argc, char *argv[])
+void expand_sid_files(vector<string> &files, bool recursive)
 {
-    signal(SIGINT, inthand); // use signal to check for signal interrupts and set inthand if so
-    SidFile sid;
-
-    string filename = "";
-    int song_number = 0;
-    calculatedclock = true;
-    calculatedhz = true;
-    use_usbsid = true;
-    use_cycles = false;
-
-    for (int param_count = 1; param_count < argc; param_count++)
+    vector<string> expanded;
+    for (string &name : files)
     {
-        if (filename.length() == 0 and argv[param_count][0] != '-')
+        std::error_code ec;
+        string ext = std::filesystem::path(name).extension().string();
+        if (ext == ".m3u" || ext == ".M3U" || ext == ".txt" || ext == ".TXT")
         {
-            filename = argv[param_count];
+            vector<string> found;
+            if (!read_playlist(name, found))
+                cerr << "error loading playlist " << name << endl;
+            expand_sid_files(found, recursive);
+            expanded.insert(expanded.end(), found.begin(), found.end());
+            continue;
         }
-        else if (!strcmp(argv[param_count], "-midi") || !strcmp(argv[param_count], "--list-midi"))
+        if (!std::filesystem::is_directory(name, ec))
         {
-            list_ports();
-            return 0;
+            expanded.push_back(name);
+            continue;
         }
-        #if defined(UNIX_COMPILE)
-        else if (!strcmp(argv[param_count], "-serial") || !strcmp(argv[param_count], "--use-serial"))
+        vector<string> found;
+        auto add = [&found](const std::filesystem::directory_entry &entry) {
+            string ext = entry.path().extension().string();
+            if ((ext == ".sid" || ext == ".SID") && !entry.is_directory())
+                found.push_back(entry.path().string());
+        };
+        if (recursive)
         {
-            use_asid = false;
-            use_serial = true;
-            use_usbsid = false;
-            //use_cycles = true;
-            param_count++;
-            if((argc - 1) >= param_count) {
-                if(strstr(argv[param_count], "/dev/") != NULL) {
-                    strcpy(USBSIDSerial, argv[param_count]);
-                } else {
-                    param_count--;
-                    strcpy(USBSIDSerial, defaultserialport);
-                }
-            } else {
-                strcpy(USBSIDSerial, defaultserialport);
-            }
-            fprintf(stdout, "Using serial port: %s\n", USBSIDSerial);
+            for (auto &entry : std::filesystem::recursive_directory_iterator(name, ec))
+                add(entry);
         }
-        #endif
-        else if (!strcmp(argv[param_count], "-asid") || !strcmp(argv[param_count], "--use-asid"))
+        else
         {
-            use_asid = true;
-            use_serial = false;
-            use_usbsid = false;
-            use_cycles = false;
-            param_count++;
-            midi_port = argv[param_count];
+            for (auto &entry : std::filesystem::directory_iterator(name, ec))
+                add(entry);
         }
-        else if (!strcmp(argv[param_count], "-c") || !strcmp(argv[param_count], "--use-cycles"))
+        std::sort(found.begin(), found.end());
+        expanded.insert(expanded.end(), found.begin(), found.end());
+    }
+    files.swap(expanded);
+}
+
+int bench_songs(vector<string> &files, int song_number, int seconds)
+{
+    uint64_t all_cycles = 0, all_frames = 0, all_writes = 0;
+    double all_emulated = 0, all_wall = 0;
+    std::unique_ptr<SidMachine> machine(new SidMachine);
+
+    printf("%-40s %8s %9s %10s %9s %10s %8s\n", "File", "Emulated", "Wall", "Cycles/s", "Plays/s", "Writes/s", "x Real");
+    for (string &name : files)
+    {
+        SidFile sid;
+        if (sid.Parse(name) != SIDFILE_OK)
         {
-            //use_asid = false;  /* No cycles with ASID */
-            //use_usbsid = true; /* Must be true */
-            use_cycles = true;
-            printf("Cycled buffer enabled\n");
-        }
-        else if (!strcmp(argv[param_count], "-sock2") || !strcmp(argv[param_count], "--socket-two"))
-        {   /* NOTE: ONLY WORKS IF THERE IS ACTUALLY A SID IN SOCKET 2 AND WITH SINGLE SID TUNES ONLY */
-            playonesockettwo = true;
+            cerr << "error loading sid file " << name << endl;
+            continue;
         }
-        else if (!strcmp(argv[param_count], "-v") || !strcmp(argv[param_count], "--verbose"))
+        int song = (song_number >= 0 && song_number < sid.GetNumOfSongs() ? song_number : sid.GetFirstSong());
+
+        auto start = std::chrono::steady_clock::now();
+        machine->Load(sid, song);
+        uint32_t rate = machine->GetPlayRate(sid, song, refreshRate[sid.GetClockSpeed()]);
+        uint64_t frames = 0;
+        uint64_t bench_frames = (uint64_t)seconds * 1000000 / rate;
+        bool stuck = false;
+        while (frames < bench_frames && !(stuck = !machine->Play()))
         {
-            verbose = true;
+            frames++;
         }
-        else if (!strcmp(argv[param_count], "-t") || !strcmp(argv[param_count], "--trace"))
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double emulated = (double)frames * rate / 1000000;
+
+        string shown = std::filesystem::path(name).filename().string();
+        printf("%-40.40s %7.1fs %7.1fms %9.2fM %9.0f %10.0f %8.1f%s\n", shown.c_str(), emulated, wall * 1000,
+               machine->GetCycles() / wall / 1e6, frames / wall, machine->GetSIDWrites() / wall, emulated / wall,
+               (stuck ? "  play routine did not return" : ""));
+        all_cycles += machine->GetCycles();
+        all_frames += frames;
+        all_writes += machine->GetSIDWrites();
+        all_emulated += emulated;
+        all_wall += wall;
+    }
+    if (all_wall > 0)
+    {
+        printf("%-40s %7.1fs %7.1fms %9.2fM %9.0f %10.0f %8.1f\n", "Total", all_emulated, all_wall * 1000,
+               all_cycles / all_wall / 1e6, all_frames / all_wall, all_writes / all_wall, all_emulated / all_wall);
+    }
+    return 0;
+}
+
+/* SID writes of the SidMachine on the log clock, as SidLogWriter times them */
+struct WavRender
+{
+    SidRenderer renderer;
+    WavWriter wav;
+    uint64_t frameBase;
+    uint64_t frameStart;
+};
+
+static void wav_write(void *user, uint64_t cycles, uint16_t addr, uint8_t value)
+{
+    WavRender *w = (WavRender *)user;
+    w->renderer.Write(w->frameBase + (cycles > w->frameStart ? cycles - w->frameStart : 0), addr, value);
+}
+
+struct RenderResult
+{
+    uint64_t frames;      /* play calls asked for */
+    uint64_t played;      /* less if the play routine got stuck */
+    uint32_t rate;        /* microseconds per play call */
+    uint32_t clock_speed;
+    int model;            /* of the first SID, as SidEmu renders it */
+    uint64_t entries;     /* log */
+    uint64_t log_cycles;
+    uint64_t samples;     /* WAV */
+    double wall;
+};
+
+static void wav_flush(WavRender &w)
+{
+    const std::vector<int16_t> &samples = w.renderer.GetSamples();
+    w.wav.Write(samples.data(), samples.size());
+    w.renderer.ClearSamples();
+}
+
+/* Emulate seconds of the Sub-Song unpaced into log (opened at log_path) and/or
+   a WAV file, without globals other than the clock settings: runs on any thread.
+   What the machines share, the opcode table and the SID kernels, is set up once
+   by whichever thread gets there first */
+static bool render_tune(SidFile &sid, int song_number, int seconds, SidLogWriter *log, const string &log_path,
+                        const string &wav_path, RenderResult &result)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<SidMachine> machine(new SidMachine);
+    machine->Load(sid, song_number);
+
+    /* same clock and timing as the player */
+    int cs = sid.GetClockSpeed();
+    uint32_t clock_speed = (calculatedclock ? clockSpeed[cs] : custom_clock > 0 ? custom_clock : CLOCK_DEFAULT);
+    uint32_t refresh_rate = (calculatedhz ? refreshRate[cs] : custom_hertz > 0 ? custom_hertz : HERTZ_DEFAULT);
+    uint32_t rate = machine->GetPlayRate(sid, song_number, refresh_rate);
+    SidLogHeader header;
+    sidlog_header(header, sid, song_number, clock_speed, rate);
+    result = RenderResult();
+    result.rate = rate;
+    result.clock_speed = clock_speed;
+    result.model = sidemu_model(header.chip_type[0]);
+    result.frames = (uint64_t)seconds * 1000000 / rate;
+
+    if (log_path.length() && !log->Open(log_path, header, machine->GetCycles()))
+    {
+        cerr << "error opening " << log_path << endl;
+        return false;
+    }
+    std::unique_ptr<WavRender> render;
+    if (wav_path.length())
+    {
+        render.reset(new WavRender);
+        render->renderer.Begin(header, wav_rate);
+        render->frameBase = 0;
+        render->frameStart = machine->GetCycles();
+        if (!render->wav.Open(wav_path, wav_rate))
         {
-            trace = true;
+            cerr << "error opening " << wav_path << endl;
+            if (log->IsOpen()) log->Close();
+            return false;
         }
-        else if (!strcmp(argv[param_count], "-d") || !strcmp(argv[param_count], "--debug"))
+    }
+
+    /* start with the registers init left behind, as push_sid_registers() */
+    uint8_t *mem = machine->GetMemory();
+    for (int j = 0; j < header.sid_count; j++)
+    {
+        for (int i = 0; i <= 0x18; i++)
         {
-            debug = true;
+            uint16_t addr = header.sid_addr[j] + i;
+            if (log->IsOpen()) log->Write(machine->GetCycles(), addr, mem[addr]);
+            if (render) render->renderer.Write(0, addr, mem[addr]);
         }
-        else if (!strcmp(argv[param_count], "-cc") || !strcmp(argv[param_count], "--customclock"))
-        {
-            param_count++;
-            calculatedclock = false;
-            custom_clock = atoi(argv[param_count]) - 1;
-            printf("READ Decimal: %i\n", atoi(argv[param_count]) - 1);
+    }
+
+    if (log->IsOpen()) machine->SetLog(log);
+    if (render) machine->SetWriteHook(wav_write, render.get());
+    uint64_t played = 0;
+    for (;;)
+    {
+        if (render)
+        { /* time the frame's writes from its start */
+            wav_flush(*render);
+            render->frameBase = played * clock_speed * rate / 1000000;
+            render->frameStart = machine->GetCycles();
         }
-        else if (!strcmp(argv[param_count], "-ch") || !strcmp(argv[param_count], "--customhertz"))
+        if (played == result.frames || !machine->Play()) break;
+        played++;
+    }
+    if (render)
+    {
+        render->renderer.RenderTo(render->frameBase);
+        wav_flush(*render);
+    }
+    machine->SetLog(nullptr);
+    machine->SetWriteHook(nullptr, nullptr);
+    result.played = played;
+
+    bool written = true;
+    if (log->IsOpen())
+    {
+        written = log->Close();
+        if (!written) cerr << "error writing " << log_path << endl;
+        result.entries = log->GetEntries();
+        result.log_cycles = log->GetCycles();
+    }
+    if (render)
+    {
+        if (!render->wav.Close())
         {
-            param_count++;
-            calculatedhz = false;
-            custom_hertz = atoi(argv[param_count]) - 1;
-            printf("READ Decimal: %i\n", atoi(argv[param_count]) - 1);
+            cerr << "error writing " << wav_path << endl;
+            written = false;
         }
-        else if (!strcmp(argv[param_count], "-rr") || !strcmp(argv[param_count], "--realreads"))
+        result.samples = render->wav.GetSamples();
+    }
+    result.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return written;
+}
+
+int render_song(SidFile &sid, int song_number, int seconds)
+{
+    RenderResult r;
+    bool written = render_tune(sid, song_number, seconds, &sid_log, record_file, wav_file, r);
+    if (r.played < r.frames)
+        cout << "Warning: play routine did not return, stopped after " << r.played << " frames" << endl;
+    printf("Rendered %.1f s of Sub-Song %d / %d in %.1f ms\n",
+           (double)r.played * r.rate / 1000000, song_number + 1, sid.GetNumOfSongs(), r.wall * 1000);
+    if (record_file.length())
+        printf("%s: %llu log entries, %.1f s on the log clock\n", record_file.c_str(),
+               (unsigned long long)r.entries, (double)r.log_cycles / r.clock_speed);
+    if (wav_file.length())
+        printf("%s: %llu samples at %u Hz, %s, %s kernels\n", wav_file.c_str(), (unsigned long long)r.samples,
+               wav_rate, chiptype[r.model == SIDEMU_8580 ? 2 : 1], sidemu_active()->name);
+    return written ? 0 : 1;
+}
+
+int batch_render(vector<string> &files, const string &out_dir, const string &format, int seconds, unsigned int threads)
+{
+    struct Job
+    {
+        int file;
+        int song;
+        int seconds;
+        string out;
+    };
+    std::error_code ec;
+    std::filesystem::create_directories(out_dir, ec);
+    if (!std::filesystem::is_directory(out_dir, ec))
+    {
+        cerr << "error creating " << out_dir << endl;
+        return 1;
+    }
+    SongLengthCache cache;
+    cache.Load(songlength_cache);
+
+    /* only the list of Sub-Songs is kept, every job loads its own file */
+    vector<Job> jobs;
+    std::set<string> names;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        SidFile sid;
+        if (sid.Parse(files[i]) != SIDFILE_OK)
         {
-            real_read = true;
+            cerr << "error loading sid file " << files[i] << endl;
+            continue;
         }
-        else if (!strcmp(argv[param_count], "-V") || !strcmp(argv[param_count], "--version"))
+        uint64_t hash = sid_hash(sid);
+        string stem = std::filesystem::path(files[i]).stem().string();
+        for (int song = 0; song < sid.GetNumOfSongs(); song++)
         {
-            cout << endl;
-            cout << "USBSIDBerry" << endl;
-            cout << "MOS SID (MOS6581/8580) and clones player for USBSID-Pico" << endl;
-            cout << "Hardware for USBSID-Pico  : LouD " << endl;
-            cout << "Low-level interface       : Gianluca Ghettini, Alessio Lombardo " << endl;
-            cout << "MOS6502 Emulator          : Gianluca Ghettini" << endl;
-            cout << "Sid Player                : Gianluca Ghettini, Alessio Lombardo " << endl;
-            cout << "Adaption for USBSID-Pico  : LouD " << endl;
-            cout << "Additional features       : LouD " << endl;
-            cout << endl;
-            return 0;
+            Job job = { (int)i, song, seconds, "" };
+            SongLength length;
+            if (seconds == 0)
+            { /* as long as the song, when --analyse found it */
+                job.seconds = 180;
+                if (cache.Find(hash, song, length) && length.kind != SONGLENGTH_NONE && length.length_ms)
+                    job.seconds = (length.length_ms + 999) / 1000;
+            }
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "_%02d", song + 1);
+            string name = stem + suffix;
+            for (int n = 2; !names.insert(name).second; n++)
+            {
+                snprintf(suffix, sizeof(suffix), "_%02d_%d", song + 1, n);
+                name = stem + suffix;
+            }
+            job.out = (std::filesystem::path(out_dir) / (name + "." + format)).string();
+            jobs.push_back(job);
         }
-        else if (!strcmp(argv[param_count], "-s") || !strcmp(argv[param_count], "--song"))
+    }
+    /* longest first, so no long one is left running alone at the end */
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.seconds > b.seconds; });
+
+    std::mutex report;
+    size_t done = 0, failed = 0;
+    double emulated = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        WorkerPool pool(threads);
+        threads = pool.GetThreadCount();
+        printf("Rendering %zu Sub-Songs of %zu file(s) to %s on %u thread(s)\n", jobs.size(), files.size(), out_dir.c_str(), threads);
+        for (Job &job : jobs)
         {
-            param_count++;
-            song_number = atoi(argv[param_count]) - 1;
+            pool.Submit([&, job] {
+                if (stop) return;
+                SidFile sid;
+                RenderResult r;
+                SidLogWriter log;
+                bool ok = sid.Parse(files[job.file]) == SIDFILE_OK;
+                if (ok)
+                {
+                    bool wav = (format == "wav");
+                    log.SetFormat(log_format(job.out));
+                    ok = render_tune(sid, job.song, job.seconds, &log, (wav ? "" : job.out), (wav ? job.out : ""), r);
+                }
+                double played = ok ? (double)r.played * r.rate / 1000000 : 0;
+                std::lock_guard<std::mutex> guard(report);
+                done++;
+                failed += !ok;
+                emulated += played;
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                printf("[%zu/%zu] %s #%d -> %s: %.0f s in %.2f s%s, %.0f s elapsed\n", done, jobs.size(),
+                       files[job.file].c_str(), job.song + 1, job.out.c_str(), played, (ok ? r.wall : 0.0),
+                       (!ok ? " FAILED" : r.played < r.frames ? " (play routine stuck)" : ""), elapsed);
+                fflush(stdout);
+            });
         }
-        else if (!strcmp(argv[param_count], "-h") || !strcmp(argv[param_count], "--help"))
+        pool.Wait();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Rendered %zu of %zu Sub-Songs, %.1f h of music in %.1f s, %.0fx real time%s\n", done - failed, jobs.size(),
+           emulated / 3600, wall, emulated / wall, (stop ? ", interrupted" : ""));
+    return failed ? 1 : 0;
+}
+
+int render_log_wav(const string &path)
+{
+    SidLogReader log;
+    if (!log.Open(path))
+    {
+        cerr << "error loading log file " << path << endl;
+        return 1;
+    }
+    const SidLogHeader &h = log.GetHeader();
+    WavRender w;
+    w.renderer.Begin(h, wav_rate);
+    if (!w.wav.Open(wav_file, wav_rate))
+    {
+        cerr << "error opening " << wav_file << endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    SidLogEntry entry;
+    while (log.Next(entry))
+    {
+        w.renderer.Write(entry);
+        if (w.renderer.GetSamples().size() >= 65536) wav_flush(w);
+    }
+    w.renderer.RenderTo(h.cycles);
+    wav_flush(w);
+    bool written = w.wav.Close();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!written)
+    {
+        cerr << "error writing " << wav_file << endl;
+        return 1;
+    }
+    double seconds = (double)h.cycles / h.clock_hz;
+    printf("Rendered %s (%.1f s) to %s in %.1f ms, %.0fx real time: %llu samples at %u Hz, %s, %s kernels\n",
+           path.c_str(), seconds, wav_file.c_str(), wall * 1000, seconds / wall, (unsigned long long)w.wav.GetSamples(),
+           wav_rate, chiptype[sidemu_model(h.chip_type[0]) == SIDEMU_8580 ? 2 : 1], sidemu_active()->name);
+    return 0;
+}
+
+int dump_song(SidFile &sid, int song_number, int seconds, int format, bool changed_only)
+{
+    std::unique_ptr<SidMachine> machine(new SidMachine);
+    machine->Load(sid, song_number);
+
+    /* same clock and timing as the player */
+    int cs = sid.GetClockSpeed();
+    uint32_t clock_speed = (calculatedclock ? clockSpeed[cs] : custom_clock > 0 ? custom_clock : CLOCK_DEFAULT);
+    uint32_t refresh_rate = (calculatedhz ? refreshRate[cs] : custom_hertz > 0 ? custom_hertz : HERTZ_DEFAULT);
+    uint32_t rate = machine->GetPlayRate(sid, song_number, refresh_rate);
+    SidLogHeader layout;
+    sidlog_header(layout, sid, song_number, clock_speed, rate);
+
+    SidDump dump(stdout, format, changed_only, layout.sid_count, clock_speed);
+    dump.Header();
+
+    uint8_t *mem = machine->GetMemory();
+    uint8_t regs[SIDLOG_MAX_SIDS * 32];
+    uint64_t frames = (uint64_t)seconds * 1000000 / rate;
+    uint64_t played = 0;
+    while (played < frames && machine->Play())
+    {
+        for (int i = 0; i < layout.sid_count; i++)
+        {
+            memcpy(regs + i * 32, mem + layout.sid_addr[i], 32);
+        }
+        dump.Row(played, played * clock_speed * rate / 1000000, regs);
+        played++;
+    }
+    dump.Flush();
+    if (played < frames)
+        cerr << "Warning: play routine did not return, stopped after " << played << " frames" << endl;
+    return 0;
+}
+
+int replay_log(const string &path, int seek_to)
+{
+    SidLogReader log;
+    if (!log.Open(path))
+    {
+        cerr << "error loading log file " << path << endl;
+        return 1;
+    }
+    const SidLogHeader &h = log.GetHeader();
+    int length = h.cycles / h.clock_hz;
+
+    cout << "\n< Log Info >" << endl;
+    cout << "---------------------------------------------" << endl;
+    cout << "SID Title          : " << h.name << endl;
+    cout << "Author Name        : " << h.author << endl;
+    cout << "Release & (C)      : " << h.released << endl;
+    cout << "---------------------------------------------" << endl;
+    cout << "Chip Type          : " << chiptype[h.chip_type[0] & 3] << endl;
+    cout << "Clock Speed        : " << dec << h.clock_hz << endl;
+    cout << "Refresh Rate       : " << dec << h.frame_us << endl;
+    cout << "Sub-Song           : " << dec << h.song + 1 << " / " << dec << (int)h.songs << endl;
+    printf("Length             : %02d:%02d, %llu entries\n", length / 60, length % 60, (unsigned long long)h.entries);
+
+    sidcount = h.sid_count;
+    sidno = 0;
+    sidone = h.sid_addr[0];
+    sidtwo = h.sid_addr[1];
+    sidthree = h.sid_addr[2];
+    sidfour = h.sid_addr[3];
+    printf("SIDS: ");
+    for (int i = 0; i < sidcount; i++)
+    {
+        printf("[%d]$%04X ", i + 1, h.sid_addr[i]);
+    }
+    printf("\n");
+
+    open_outputs(h.clock_hz, (h.clock_hz == CLOCK_PAL), (h.chip_type[0] == 1));
+
+    auto start = std::chrono::steady_clock::now();
+    if (seek_to > 0)
+    { /* continue with the registers as they were written at that time */
+        uint64_t target = (uint64_t)seek_to * h.clock_hz;
+        log.Seek(target);
+        uint8_t regs[SIDLOG_MAX_SIDS * 32];
+        log.GetRegisters(regs);
+        for (int i = 0; i < sidcount; i++)
+        {
+            for (int j = 0; j <= 0x18; j++)
+            {
+                MemWrite(h.sid_addr[i] + j, regs[i * 32 + j]);
+            }
+        }
+        start -= std::chrono::seconds(seek_to);
+    }
+
+    cout << "\n< Player Commands >" << endl;
+    cout << "Space       : Pause/Continue " << endl;
+    cout << "Q or Escape : Quit " << endl
+         << endl;
+
+    SidLogEntry entry;
+    int shown = -1;
+    bool quit = false;
+    while (!stop && !quit && log.Next(entry))
+    {
+        if (entry.chip >= sidcount) continue;
+        /* the log clock in nanoseconds, split to not overflow on long logs */
+        uint64_t ns = (entry.cycle / h.clock_hz) * 1000000000ULL + (entry.cycle % h.clock_hz) * 1000000000ULL / h.clock_hz;
+        auto due = start + std::chrono::nanoseconds(ns);
+        if (due > std::chrono::steady_clock::now() + std::chrono::milliseconds(1))
+        { /* a gap, mostly between frames: hand over what is queued and wait */
+            if (use_asid) asid_flush();
+            if (use_cycles) us_sid->USBSID_SetFlush();
+            if (use_fanout) fanout.EndFrame();
+
+            int sec = entry.cycle / h.clock_hz;
+            int key = getch_noecho_special_char();
+            if (key == 256 || key == (int)'q') break;
+            if (key == 32)
+            { /* pause with the volume at zero */
+                auto paused = std::chrono::steady_clock::now();
+                uint8_t vol[4];
+                for (int i = 0; i < sidcount; i++)
+                {
+                    vol[i] = memory[h.sid_addr[i] + 0x18];
+                    MemWrite(h.sid_addr[i] + 0x18, vol[i] & 0xF0);
+                }
+                if (use_asid) asid_flush();
+                if (use_cycles) us_sid->USBSID_SetFlush();
+                if (use_fanout) fanout.Flush();
+                printf("\rPaused [%02d:%02d] / [%02d:%02d]            ", sec / 60, sec % 60, length / 60, length % 60);
+                fflush(stdout);
+                for (;;)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100000));
+                    key = getch_noecho_special_char();
+                    if (stop || key == 32 || key == 256 || key == (int)'q') break;
+                }
+                quit = (key == 256 || key == (int)'q');
+                for (int i = 0; i < sidcount; i++)
+                {
+                    MemWrite(h.sid_addr[i] + 0x18, vol[i]);
+                }
+                start += std::chrono::steady_clock::now() - paused;
+                due = start + std::chrono::nanoseconds(ns);
+                shown = -1;
+            }
+            if (sec != shown)
+            {
+                shown = sec;
+                printf("\rPlay log [%02d:%02d] / [%02d:%02d]            ", sec / 60, sec % 60, length / 60, length % 60);
+                fflush(stdout);
+            }
+            std::this_thread::sleep_until(due);
+        }
+        cyclecount = entry.cycle;
+        MemWrite(h.sid_addr[entry.chip] + entry.reg, entry.value);
+    }
+    if (!stop || fanout.IsOpen()) exitPlayer();  /* inthand leaves the board to us */
+    return 0;
+}
+
+int convert_log(const string &in, const string &out)
+{
+    SidLogReader log;
+    if (!log.Open(in))
+    {
+        cerr << "error loading log file " << in << endl;
+        return 1;
+    }
+    SidLogHeader h = log.GetHeader();
+    SidLogWriter writer;
+    writer.SetFormat(log_format(out));
+    if (!writer.Open(out, h, 0))
+    {
+        cerr << "error opening " << out << endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    SidLogEntry entry;
+    while (log.Next(entry))
+    {
+        writer.Append(entry);
+    }
+    bool written = writer.Close();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!written)
+    {
+        cerr << "error writing " << out << endl;
+        return 1;
+    }
+
+    /* read it back as the player would, timing the decoder alone */
+    SidLogReader result;
+    if (!result.Open(out))
+    {
+        cerr << "error loading log file " << out << endl;
+        return 1;
+    }
+    uint64_t entries = 0;
+    uint64_t check = 0;
+    start = std::chrono::steady_clock::now();
+    while (result.Next(entry))
+    {
+        entries++;
+        check += entry.cycle ^ entry.value;
+    }
+    double decode = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    /* the size as a raw log, clock-only entries included */
+    double raw = SIDLOG_HEADER_SIZE + (double)writer.GetEntries() * SIDLOG_ENTRY_SIZE;
+
+    printf("Converted %s (%zu bytes) to %s (%zu bytes) in %.1f ms\n", in.c_str(), log.GetFileSize(),
+           out.c_str(), result.GetFileSize(), wall * 1000);
+    printf("%llu entries, %.1f s on the log clock, ratio %.2f:1 to a raw log\n", (unsigned long long)entries,
+           (double)result.GetHeader().cycles / h.clock_hz, raw / result.GetFileSize());
+    printf("Decoding: %.2f ms, %.1f M entries/s, %.1f MB/s of raw log (check %llx)\n", decode * 1000,
+           entries / decode / 1e6, raw / decode / 1e6, (unsigned long long)check);
+    return 0;
+}
+
+int analyse_songs(vector<string> &files)
+{
+    struct Job
+    {
+        int file;
+        int song;
+        bool cached;
+        SongLength length;
+    };
+    SongLengthCache cache;
+    cache.Load(songlength_cache);
+    vector<unique_ptr<SidFile>> sids(files.size());
+    vector<uint64_t> hashes(files.size());
+    vector<Job> jobs;
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        sids[i].reset(new SidFile);
+        if (sids[i]->Parse(files[i]) != SIDFILE_OK)
+        {
+            cerr << "error loading sid file " << files[i] << endl;
+            continue;
+        }
+        hashes[i] = sid_hash(*sids[i]);
+        for (int song = 0; song < sids[i]->GetNumOfSongs(); song++)
+        {
+            Job job = { (int)i, song, false, { SONGLENGTH_NONE, 0, 0 } };
+            job.cached = cache.Find(hashes[i], song, job.length);
+            jobs.push_back(job);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    {
+        WorkerPool pool(threads);
+        for (Job &job : jobs)
+        {
+            if (job.cached) continue;
+            pool.Submit([&job, &sids] {
+                SidFile &sid = *sids[job.file];
+                job.length = analyse_song(sid, job.song, refreshRate[sid.GetClockSpeed()]);
+            });
+        }
+        pool.Wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int analysed = 0;
+    for (Job &job : jobs)
+    {
+        const char *kind = (job.length.kind == SONGLENGTH_END ? "end " : job.length.kind == SONGLENGTH_LOOP ? "loop" : "none");
+        printf("%s #%d: %s %s", files[job.file].c_str(), job.song + 1, kind, songlength_time(job.length.length_ms).c_str());
+        if (job.length.kind == SONGLENGTH_LOOP)
+            printf(" (loops to %s)", songlength_time(job.length.loop_ms).c_str());
+        printf("%s\n", (job.cached ? " [cached]" : ""));
+        if (!job.cached)
+        {
+            cache.Set(hashes[job.file], job.song, job.length, files[job.file]);
+            analysed++;
+        }
+    }
+    printf("Analysed %d Sub-Songs in %.2f s on %u thread(s)\n", analysed, seconds, threads);
+    if (analysed && !cache.Save(songlength_cache))
+    {
+        cerr << "error writing " << songlength_cache << endl;
+        return 1;
+    }
+    return 0;
+}
+
+void USBSIDSetup(void)
+{
+    us_sid = new USBSID_NS::USBSID_Class();
+    if (use_usbsid && !use_cycles) {
+        printf("Opening USBSID-Pico\n");
+        if (us_sid->USBSID_Init(false, false) < 0) {
+            printf("USBSID-Pico not found, exiting...\n");
+            exit(1);
+        }
+    }
+    if (use_usbsid && use_cycles) {
+        printf("Opening USBSID-Pico with buffer for cycle exact writing\n");
+        if (us_sid->USBSID_Init(true, true) < 0) {
+            printf("USBSID-Pico not found, exiting...\n");
+            exit(1);
+        }
+    }
+    /* Sleep 400ms for Reset to settle */
+    struct timespec tv = { .tv_sec = 0, .tv_nsec = (400 * 1000 * 1000) };
+    nanosleep(&tv, &tv);
+    #ifndef NO_REBOOT
+    us_sid->USBSID_Mute();
+    us_sid->USBSID_ClearBus();
+    us_sid->USBSID_UnMute();
+    #endif
+}
+
+char * midi_port;
+
+int log_format(const string &path)
+{
+    const string ext = ".sidpack";
+    if (path.length() < ext.length() || path.compare(path.length() - ext.length(), ext.length(), ext) != 0)
+        return SIDLOG_RAW;
+    return record_entropy ? SIDLOG_PACK_ENTROPY : SIDLOG_PACK;
+}
+
+void open_outputs(int clock_speed, bool is_pal, bool is_6581)
+{
+    if (use_fanout) {
+        uint16_t sid_addr[4] = { (uint16_t)sidone, (uint16_t)sidtwo, (uint16_t)sidthree, (uint16_t)sidfour };
+        string error;
+        if (!fanout.Parse(fanout_map, sid_addr, sidcount, error)) {
+            printf("[ERROR] --fanout %s: %s\n", fanout_map.c_str(), error.c_str());
+            exit(1);
+        }
+        for (const UsbFanout::Route &route : fanout.GetRoutes()) {
+            printf("[FANOUT] $%04X -> USBSID-Pico SID %d\n", route.addr, route.slot + 1);
+        }
+        if (!fanout.Open(clock_speed)) exit(1);
+    }
+    if (use_usbsid) {
+        USBSIDSetup();  /* Setup for playing SID files */
+
+        if(us_sid->USBSID_GetClockRate() != clock_speed) {
+            us_sid->USBSID_SetClockRate(clock_speed, true);
+        }
+
+        if(us_sid->USBSID_GetNumSIDs() < sidcount) {
+            printf("[WARNING] Tune no.sids %d is higher then USBSID-Pico no.sids %d\n", sidcount, us_sid->USBSID_GetNumSIDs());
+        }
+
+        uint8_t socket_config[10];
+        us_sid->USBSID_GetSocketConfig(socket_config);
+        printf("SOCKET CONFIG: ");
+        for (int i = 0; i < 10; i++) {
+            printf("%02X ", socket_config[i]);
+        }
+        printf("\n");
+
+        printf("SOCK1#.%d SID1:%d SID2:%d\nSOCK2#.%d SID1:%d SID2:%d\n",
+            us_sid->USBSID_GetSocketNumSIDS(1, socket_config),
+            us_sid->USBSID_GetSocketSIDType1(1, socket_config),
+            us_sid->USBSID_GetSocketSIDType2(1, socket_config),
+            us_sid->USBSID_GetSocketNumSIDS(2, socket_config),
+            us_sid->USBSID_GetSocketSIDType1(2, socket_config),
+            us_sid->USBSID_GetSocketSIDType2(2, socket_config)
+        );
+
+        sidssockone = us_sid->USBSID_GetSocketNumSIDS(1, socket_config);
+        sidssocktwo = us_sid->USBSID_GetSocketNumSIDS(2, socket_config);
+        sockonesidone = us_sid->USBSID_GetSocketSIDType1(1, socket_config);
+        sockonesidtwo = us_sid->USBSID_GetSocketSIDType2(1, socket_config);
+        socktwosidone = us_sid->USBSID_GetSocketSIDType1(2, socket_config);
+        socktwosidtwo = us_sid->USBSID_GetSocketSIDType2(2, socket_config);
+        fmoplsidno = us_sid->USBSID_GetFMOplSID();
+        pcbversion = us_sid->USBSID_GetPCBVersion();
+    }
+
+    if (use_asid) {
+        asid_init(midi_port, sidcount);
+        sendSIDEnvironment(is_pal);
+        sendSIDType(is_6581);
+    }
+
+    #if defined(UNIX_COMPILE)
+    if (use_serial) {
+        open_serialport();
+	    uint8_t packet_size = (use_cycles ? 0x04 : 0x02);
+        uint8_t initpacket[8] = {
+	        0xFF,0xEE,0xDD,
+            0x00, // packet size high byte
+            packet_size, // packet size low byte
+	        0xDD,0xEE,0xFF
+	    };
+	    serial_write_chars(initpacket,8);
+    }
+    #endif
+}
+
+int main(int argc, char *argv[])
+{
+    signal(SIGINT, inthand); // use signal to check for signal interrupts and set inthand if so
+    SidFile sid;
+
+    string filename = "";
+    vector<string> files;
+    bool analyse = false;
+    int bench = 0;  /* emulated seconds per file */
+    int render = 0;  /* emulated seconds to record */
+    int dump = 0;    /* emulated seconds to export */
+    string batch_dir = "";
+    string batch_format = "wav";
+    unsigned int batch_jobs = 0;
+    int dump_format = SIDDUMP_TEXT;
+    bool dump_changed = false;
+    string play_log = "";
+    string convert_in = "", convert_out = "";
+    bool song_given = false;
+    int song_number = 0;
+    int seek_to = -1;
+    calculatedclock = true;
+    calculatedhz = true;
+    use_usbsid = true;
+    use_cycles = false;
+
+    for (int param_count = 1; param_count < argc; param_count++)
+    {
+        if (argv[param_count][0] != '-')
+        {
+            if (filename.length() == 0)
+                filename = argv[param_count];
+            files.push_back(argv[param_count]);
+        }
+        else if (!strcmp(argv[param_count], "-midi") || !strcmp(argv[param_count], "--list-midi"))
+        {
+            list_ports();
+            return 0;
+        }
+        #if defined(UNIX_COMPILE)
+        else if (!strcmp(argv[param_count], "-serial") || !strcmp(argv[param_count], "--use-serial"))
+        {
+            use_asid = false;
+            use_serial = true;
+            use_usbsid = false;
+            //use_cycles = true;
+            param_count++;
+            if((argc - 1) >= param_count) {
+                if(strstr(argv[param_count], "/dev/") != NULL) {
+                    strcpy(USBSIDSerial, argv[param_count]);
+                } else {
+                    param_count--;
+                    strcpy(USBSIDSerial, defaultserialport);
+                }
+            } else {
+                strcpy(USBSIDSerial, defaultserialport);
+            }
+            fprintf(stdout, "Using serial port: %s\n", USBSIDSerial);
+        }
+        #endif
+        else if (!strcmp(argv[param_count], "-asid") || !strcmp(argv[param_count], "--use-asid"))
+        {
+            use_asid = true;
+            use_serial = false;
+            use_usbsid = false;
+            use_cycles = false;
+            param_count++;
+            midi_port = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-fo") || !strcmp(argv[param_count], "--fanout"))
+        {
+            param_count++;
+            if (param_count < argc) {
+                use_fanout = true;
+                use_usbsid = false;  /* the board is opened by the fan-out */
+                fanout_map = argv[param_count];
+            }
+        }
+        else if (!strcmp(argv[param_count], "-sw") || !strcmp(argv[param_count], "--sync-writes"))
+        {
+            sync_writes = true;
+        }
+        else if (!strcmp(argv[param_count], "-c") || !strcmp(argv[param_count], "--use-cycles"))
+        {
+            //use_asid = false;  /* No cycles with ASID */
+            //use_usbsid = true; /* Must be true */
+            use_cycles = true;
+            printf("Cycled buffer enabled\n");
+        }
+        else if (!strcmp(argv[param_count], "-sock2") || !strcmp(argv[param_count], "--socket-two"))
+        {   /* NOTE: ONLY WORKS IF THERE IS ACTUALLY A SID IN SOCKET 2 AND WITH SINGLE SID TUNES ONLY */
+            playonesockettwo = true;
+        }
+        else if (!strcmp(argv[param_count], "-v") || !strcmp(argv[param_count], "--verbose"))
+        {
+            verbose = true;
+        }
+        else if (!strcmp(argv[param_count], "-t") || !strcmp(argv[param_count], "--trace"))
+        {
+            trace = true;
+        }
+        else if (!strcmp(argv[param_count], "-d") || !strcmp(argv[param_count], "--debug"))
+        {
+            debug = true;
+        }
+        else if (!strcmp(argv[param_count], "-cc") || !strcmp(argv[param_count], "--customclock"))
+        {
+            param_count++;
+            calculatedclock = false;
+            custom_clock = atoi(argv[param_count]) - 1;
+            printf("READ Decimal: %i\n", atoi(argv[param_count]) - 1);
+        }
+        else if (!strcmp(argv[param_count], "-ch") || !strcmp(argv[param_count], "--customhertz"))
+        {
+            param_count++;
+            calculatedhz = false;
+            custom_hertz = atoi(argv[param_count]) - 1;
+            printf("READ Decimal: %i\n", atoi(argv[param_count]) - 1);
+        }
+        else if (!strcmp(argv[param_count], "-rr") || !strcmp(argv[param_count], "--realreads"))
+        {
+            real_read = true;
+        }
+        else if (!strcmp(argv[param_count], "-rs") || !strcmp(argv[param_count], "--read-resync"))
+        {
+            param_count++;
+            if (param_count < argc)
+                read_resync = std::max(0, atoi(argv[param_count]));
+        }
+        else if (!strcmp(argv[param_count], "-V") || !strcmp(argv[param_count], "--version"))
+        {
+            cout << endl;
+            cout << "USBSIDBerry" << endl;
+            cout << "MOS SID (MOS6581/8580) and clones player for USBSID-Pico" << endl;
+            cout << "Hardware for USBSID-Pico  : LouD " << endl;
+            cout << "Low-level interface       : Gianluca Ghettini, Alessio Lombardo " << endl;
+            cout << "MOS6502 Emulator          : Gianluca Ghettini" << endl;
+            cout << "Sid Player                : Gianluca Ghettini, Alessio Lombardo " << endl;
+            cout << "Adaption for USBSID-Pico  : LouD " << endl;
+            cout << "Additional features       : LouD " << endl;
+            cout << endl;
+            return 0;
+        }
+        else if (!strcmp(argv[param_count], "-s") || !strcmp(argv[param_count], "--song"))
+        {
+            param_count++;
+            song_number = atoi(argv[param_count]) - 1;
+            song_given = true;
+        }
+        else if (!strcmp(argv[param_count], "-ss") || !strcmp(argv[param_count], "--seek"))
+        {
+            param_count++;
+            int mm = 0, ss = 0;
+            if (sscanf(argv[param_count], "%d:%d", &mm, &ss) == 2)
+                seek_to = (mm * 60) + ss;
+            else
+                seek_to = atoi(argv[param_count]);
+        }
+        else if (!strcmp(argv[param_count], "-rb") || !strcmp(argv[param_count], "--rewind-buffer"))
+        {
+            param_count++;
+            rewind_ring.SetCapacity((size_t)atoi(argv[param_count]) << 20);
+        }
+        else if (!strcmp(argv[param_count], "-b") || !strcmp(argv[param_count], "--bench"))
+        {
+            bench = 60;
+            if (param_count + 1 < argc && isdigit((unsigned char)argv[param_count + 1][0]))
+            {
+                param_count++;
+                bench = std::max(1, atoi(argv[param_count]));
+            }
+        }
+        else if (!strcmp(argv[param_count], "-rec") || !strcmp(argv[param_count], "--record"))
+        {
+            param_count++;
+            record_file = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-rd") || !strcmp(argv[param_count], "--render"))
+        {
+            render = 180;
+            if (param_count + 1 < argc && isdigit((unsigned char)argv[param_count + 1][0]))
+            {
+                param_count++;
+                render = std::max(1, atoi(argv[param_count]));
+            }
+        }
+        else if (!strcmp(argv[param_count], "-wav") || !strcmp(argv[param_count], "--wav"))
+        {
+            param_count++;
+            wav_file = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-wr") || !strcmp(argv[param_count], "--wav-rate"))
+        {
+            param_count++;
+            wav_rate = std::max(8000, std::min(192000, atoi(argv[param_count])));
+        }
+        else if (!strcmp(argv[param_count], "-ba") || !strcmp(argv[param_count], "--batch"))
+        {
+            param_count++;
+            batch_dir = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-bf") || !strcmp(argv[param_count], "--batch-format"))
+        {
+            param_count++;
+            batch_format = argv[param_count];
+            if (batch_format != "wav" && batch_format != "sidlog" && batch_format != "sidpack")
+            {
+                cerr << "--batch-format must be wav, sidlog or sidpack" << endl;
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[param_count], "-j") || !strcmp(argv[param_count], "--jobs"))
+        {
+            param_count++;
+            batch_jobs = std::max(1, atoi(argv[param_count]));
+        }
+        else if (!strcmp(argv[param_count], "-dp") || !strcmp(argv[param_count], "--dump"))
+        {
+            dump = 60;
+            if (param_count + 1 < argc && isdigit((unsigned char)argv[param_count + 1][0]))
+            {
+                param_count++;
+                dump = std::max(1, atoi(argv[param_count]));
+            }
+        }
+        else if (!strcmp(argv[param_count], "-dv") || !strcmp(argv[param_count], "--dump-csv"))
+        {
+            dump_format = SIDDUMP_CSV;
+        }
+        else if (!strcmp(argv[param_count], "-dc") || !strcmp(argv[param_count], "--dump-changed"))
+        {
+            dump_changed = true;
+        }
+        else if (!strcmp(argv[param_count], "-pl") || !strcmp(argv[param_count], "--play-log"))
+        {
+            param_count++;
+            play_log = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-cv") || !strcmp(argv[param_count], "--convert"))
+        {
+            param_count++;
+            convert_in = argv[param_count];
+            param_count++;
+            convert_out = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-nz") || !strcmp(argv[param_count], "--no-entropy"))
+        {
+            record_entropy = false;
+        }
+        else if (!strcmp(argv[param_count], "-a") || !strcmp(argv[param_count], "--analyse"))
+        {
+            analyse = true;
+        }
+        else if (!strcmp(argv[param_count], "-lc") || !strcmp(argv[param_count], "--length-cache"))
+        {
+            param_count++;
+            songlength_cache = argv[param_count];
+        }
+        else if (!strcmp(argv[param_count], "-h") || !strcmp(argv[param_count], "--help"))
         {
             cout << endl;
             cout << "Usage: " << argv[0] << " <Sid Filename> [Options]" << endl;
+            cout << "       " << argv[0] << " <Sid Files or folders> -a | -b [Options]" << endl;
+            cout << "       " << argv[0] << " <Sid Files, folders or playlists> -ba <Folder> [Options]" << endl;
+            cout << "       " << argv[0] << " -pl <Log Filename> [Options]" << endl;
+            cout << "       " << argv[0] << " -cv <Log Filename> <Log Filename> [Options]" << endl;
             cout << "Options: " << endl;
             cout << " -s,  --song          : Set Sub-Song number (default depends on the Sid File) " << endl;
+            cout << " -ss, --seek          : Start playing at mm:ss (or seconds), skipped part is emulated silently " << endl;
+            cout << " -rb, --rewind-buffer : Memory in MB for seeking back without replaying from the start (default 8, 0 = off) " << endl;
+            cout << " -a,  --analyse       : Find the length / loop point of every Sub-Song of all given Sid Files, no playback " << endl;
+            cout << " -b,  --bench [secs]  : Emulate secs (default 60) of every given Sid File unpaced, no output, and show the speed " << endl;
+            cout << " -lc, --length-cache  : Song length file written by --analyse (default songlengths.txt) " << endl;
+            cout << " -rec, --record       : Record all SID writes with their cycle timing to a binary log file, packed if it ends in .sidpack " << endl;
+            cout << " -rd, --render [secs] : With --record and/or --wav, emulate secs (default 180) unpaced, no playback " << endl;
+            cout << " -wav, --wav          : Render with the built-in software SID to a WAV file, with --render or --play-log " << endl;
+            cout << " -wr, --wav-rate      : Sample rate of the WAV file (default 44100) " << endl;
+            cout << " -ba, --batch         : Render every Sub-Song of the given files, folders (recursive) and playlists into a folder " << endl;
+            cout << " -bf, --batch-format  : wav (default), sidlog or sidpack; length from --render or the length cache, else 180 s " << endl;
+            cout << " -j,  --jobs          : Threads for --batch (default one per core) " << endl;
+            cout << " -dp, --dump [secs]   : Print the SID registers after every play call of secs (default 60) unpaced, no playback " << endl;
+            cout << " -dv, --dump-csv      : With --dump, print CSV instead of a text table " << endl;
+            cout << " -dc, --dump-changed  : With --dump, print only the values that changed " << endl;
+            cout << " -pl, --play-log      : Play a log made by --record without emulating the CPU " << endl;
+            cout << " -cv, --convert       : Convert log <in> to <out>, a .sidpack file name packs it, and show ratio and decode speed " << endl;
+            cout << " -nz, --no-entropy    : Pack .sidpack logs without the range coder (larger, faster to decode) " << endl;
             cout << " -v,  --verbose       : Verbose mode (show SID registers content) " << endl;
             cout << " -t,  --trace         : Trace mode (prints some additional trace logging) " << endl;
             cout << " -V,  --version       : Show version and other informations " << endl;
@@ -765,7 +1896,11 @@ int main(int argc, char *argv[])
             cout << " Experimental features: " << endl;
             cout << " -cc,  --customclock  : Manually define the clockspeed " << endl;
             cout << " -ch,  --customhertz  : Manually define the refreshrate (Hz) by ms " << endl;
-            cout << " -rr,  --realreads    : Reads the datapins when a SID needs to (unfinished, defaults to true for USBSID-Pico) " << endl;
+            cout << " -rr,  --realreads    : Read OSC3/ENV3 from the USBSID-Pico on every read instead of the voice 3 model (slow, not with -c) " << endl;
+            cout << " -rs,  --read-resync  : Correct the voice 3 model from the USBSID-Pico every n frames (default 0: never) " << endl;
+            cout << " -sw,  --sync-writes  : Write every register to the USBSID-Pico at once instead of per frame from a thread " << endl;
+            cout << " -fo,  --fanout       : Map SIDs to USBSID-Pico SID slots: <sid>=<slot>[+<slot>],... with sid 1-4 or an " << endl;
+            cout << "                        address like $D500 and slot 0-3, e.g. 1=0+2,2=1 (mirrors SID 1 to slots 0 and 2) " << endl;
             cout << endl;
             return 0;
         }
@@ -775,6 +1910,41 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (use_fanout && use_cycles)
+    {
+        cout << "Warning: No cycled buffer with --fanout" << endl;
+        use_cycles = false;
+    }
+    expand_sid_files(files, batch_dir.length() > 0);
+    if (batch_dir.length())
+    {
+        unsigned int threads = batch_jobs ? batch_jobs : std::max(1u, std::thread::hardware_concurrency());
+        return batch_render(files, batch_dir, batch_format, render, threads);
+    }
+    if (analyse)
+    {
+        return analyse_songs(files);
+    }
+    if (bench)
+    {
+        return bench_songs(files, (song_given ? song_number : -1), bench);
+    }
+    sid_log.SetFormat(log_format(record_file));
+    if (convert_in.length())
+    {
+        return convert_log(convert_in, convert_out);
+    }
+    if (play_log.length())
+    {
+        if (wav_file.length())
+            return render_log_wav(play_log);
+        return replay_log(play_log, seek_to);
+    }
+    if (files.size() > 1)
+    {
+        cout << "Warning: Only playing " << filename << endl;
+    }
+
     int res = sid.Parse(filename);
     if (song_number < 0 or song_number >= sid.GetNumOfSongs())
     {
@@ -794,6 +1964,20 @@ int main(int argc, char *argv[])
         return 2;
     }
 
+    if (render)
+    {
+        if (record_file.length() == 0 && wav_file.length() == 0)
+        {
+            cerr << "--render needs --record <file> or --wav <file>" << endl;
+            return 1;
+        }
+        return render_song(sid, song_number, render);
+    }
+    if (dump)
+    {
+        return dump_song(sid, song_number, dump, dump_format, dump_changed);
+    }
+
     int sidflags = sid.GetSidFlags();
     uint32_t sidspeed = sid.GetSongSpeed(song_number); // + 1);
     int curr_sidspeed = sidspeed & (1 << song_number); // ? 1 : 0;  // 1 ~ 60Hz, 2 ~ 50Hz
@@ -858,6 +2042,15 @@ int main(int argc, char *argv[])
     cout << "Song Speed(s)      : $" << hex << curr_sidspeed << " $0x" << hex << sidspeed << " 0b" << bitset<32>{sidspeed} << endl;
     cout << "Timer              : " << (curr_sidspeed == 1 ? "CIA1" : "Clock") << endl;
     cout << "Selected Sub-Song  : " << dec << song_number + 1 << " / " << dec << sid.GetNumOfSongs() << endl;
+    SongLengthCache lengths;
+    SongLength length;
+    if (lengths.Load(songlength_cache) && lengths.Find(sid_hash(sid), song_number, length) && length.kind != SONGLENGTH_NONE)
+    {
+        cout << "Song Length        : " << songlength_time(length.length_ms);
+        if (length.kind == SONGLENGTH_LOOP)
+            cout << " (loops to " << songlength_time(length.loop_ms) << ")";
+        cout << endl;
+    }
 
     sidcount =
         sv == 3
@@ -886,66 +2079,19 @@ int main(int argc, char *argv[])
     }
     printf("\n");
 
-    if (use_usbsid) {
-        USBSIDSetup();  /* Setup for playing SID files */
-
-        if(us_sid->USBSID_GetClockRate() != clock_speed) {
-            us_sid->USBSID_SetClockRate(clock_speed, true);
-        }
-
-        if(us_sid->USBSID_GetNumSIDs() < sidcount) {
-            printf("[WARNING] Tune no.sids %d is higher then USBSID-Pico no.sids %d\n", sidcount, us_sid->USBSID_GetNumSIDs());
-        }
-
-        uint8_t socket_config[10];
-        us_sid->USBSID_GetSocketConfig(socket_config);
-        printf("SOCKET CONFIG: ");
-        for (int i = 0; i < 10; i++) {
-            printf("%02X ", socket_config[i]);
-        }
-        printf("\n");
-
-        printf("SOCK1#.%d SID1:%d SID2:%d\nSOCK2#.%d SID1:%d SID2:%d\n",
-            us_sid->USBSID_GetSocketNumSIDS(1, socket_config),
-            us_sid->USBSID_GetSocketSIDType1(1, socket_config),
-            us_sid->USBSID_GetSocketSIDType2(1, socket_config),
-            us_sid->USBSID_GetSocketNumSIDS(2, socket_config),
-            us_sid->USBSID_GetSocketSIDType1(2, socket_config),
-            us_sid->USBSID_GetSocketSIDType2(2, socket_config)
-        );
-
-        sidssockone = us_sid->USBSID_GetSocketNumSIDS(1, socket_config);
-        sidssocktwo = us_sid->USBSID_GetSocketNumSIDS(2, socket_config);
-        sockonesidone = us_sid->USBSID_GetSocketSIDType1(1, socket_config);
-        sockonesidtwo = us_sid->USBSID_GetSocketSIDType2(1, socket_config);
-        socktwosidone = us_sid->USBSID_GetSocketSIDType1(2, socket_config);
-        socktwosidtwo = us_sid->USBSID_GetSocketSIDType2(2, socket_config);
-        fmoplsidno = us_sid->USBSID_GetFMOplSID();
-        pcbversion = us_sid->USBSID_GetPCBVersion();
-    }
-
-    if (use_asid) {
-        asid_init(midi_port, sidcount);
-        sendSIDEnvironment((cs == 1));
-        sendSIDType((ct == 1));
-    }
-
-    #if defined(UNIX_COMPILE)
-    if (use_serial) {
-        open_serialport();
-	    uint8_t packet_size = (use_cycles ? 0x04 : 0x02);
-        uint8_t initpacket[8] = {
-	        0xFF,0xEE,0xDD,
-            0x00, // packet size high byte
-            packet_size, // packet size low byte
-	        0xDD,0xEE,0xFF
-	    };
-	    serial_write_chars(initpacket,8);
-    }
-    #endif
+    open_outputs(clock_speed, (cs == 1), (ct == 1));
 
     srand(0);
-    mos6502 cpu(MemRead, MemWrite, CycleFn);
+    mos6502 cpu(MemRead, MemWrite, (debug ? CycleFn : nullptr));  /* trace after every instruction */
+    cpu.SetPageFlags(0xD4, 0xDF, mos6502::PAGE_VOLATILE); /* OSC3/ENV3 reads */
+    if (!debug)  /* keep last_raddr/last_waddr complete for the trace */
+    {
+        cpu.SetRAM(memory);
+        cpu.SetPageFlags(0x00, 0xD3, mos6502::PAGE_DIRECT);  /* RAM below the SID area */
+        cpu.SetPageFlags(0xE0, 0xFF, mos6502::PAGE_DIRECT);  /* RAM above the I/O area */
+    }
+    cpu.SetIdleSkip(true);
+    cpu.SetBlockCache(true);
 
     int sec = 0;
     int min = 0;
@@ -955,7 +2101,9 @@ int main(int argc, char *argv[])
     bool exit = false;
     uint8_t mode_vol_reg = volume;
 
+    read_model_reset(sid);
     load_sid(cpu, sid, song_number);
+    preinit_subtunes(sid, song_number);
 
     if (verbose)
         cout << endl;
@@ -965,6 +2113,7 @@ int main(int argc, char *argv[])
     cout << "Left  Arrow : Previous Sub-Song " << endl;
     cout << "Right Arrow : Next Sub-Song " << endl;
     cout << "R           : Restart current Sub-Song " << endl;
+    cout << "F / B       : Seek 10 seconds forward / back " << endl;
     cout << "V           : Verbose (show SID registers) " << endl;
     cout << "W           : Volume up " << endl;
     cout << "S           : Volume down " << endl;
@@ -977,15 +2126,34 @@ int main(int argc, char *argv[])
     printf("\rPlay Sub-Song %d / %d [%02d:%02d] @ Volume: %d            ", song_number + 1, sid.GetNumOfSongs(), min, sec, volume);
     fflush(stdout);
 
-    int play_rate = 0;
     if (curr_sidspeed == 1) {
         play_rate = (memory[CIA_TIMER_HI] << 8 | memory[CIA_TIMER_LO]);  /* CIA timing */
         play_rate = play_rate == 0 ? refresh_rate : play_rate;
     } else {
         play_rate = refresh_rate;
     }
+    rewind_interval = (play_rate > 0 && play_rate < 1000000 ? 1000000 / play_rate : 1);  /* once a second */
+    if (record_file.length())
+    {
+        SidLogHeader header;
+        sidlog_header(header, sid, song_number, clock_speed, play_rate);
+        if (!sid_log.Open(record_file, header, cyclecount))
+        {
+            cerr << "error opening " << record_file << endl;
+            return 1;
+        }
+        push_sid_registers();  /* the log starts with the state init left behind */
+    }
     // printf("\n%d %d %d\n", play_rate, memory[0xDC04] + memory[0xDC05] * 256, memory[0xDC05] << 8 | memory[0xDC04]);
     // printf("\n%d %d %d\n", play_rate, memory[0xDC06] + memory[0xDC07] * 256, memory[0xDC06] << 8 | memory[0xDC07]);
+    if (seek_to > 0)
+    {
+        seek_song(cpu, sid, song_number, seek_to, &sec, &min);
+        if (!stop) printf("\rPlay Sub-Song %d / %d [%02d:%02d] @ Volume: %d            ", song_number + 1, sid.GetNumOfSongs(), min, sec, volume);
+        fflush(stdout);
+    }
+    if (use_usbsid && !use_cycles && !sync_writes && !stop)
+        usb_pipeline.Start(usb_submit, nullptr);
     gettimeofday(&c1, NULL);
     gettimeofday(&c2, NULL);
     while (!exit || !stop)
@@ -994,6 +2162,8 @@ int main(int argc, char *argv[])
         while (paused)
         {
             change_player_status(cpu, sid, getch_noecho_special_char(), &paused, &exit, &mode_vol_reg, &song_number, &sec, &min);
+            usb_pipeline.Flush();  /* volume changes while paused */
+            if (use_fanout) fanout.Flush();
             std::this_thread::sleep_for(std::chrono::microseconds(100000));
         }
 
@@ -1009,12 +2179,10 @@ int main(int argc, char *argv[])
             // if (use_asid) asid_flush();
             continue;
         }
-        // trigger IRQ interrupt
-        cpu.IRQ();
-
-        // execute the player routine
-        cpu.RunN(0, cyclecount);
-        // cpu.Run(1, cyclecount, cpu.CYCLE_COUNT); // 100000 clockcycles
+        play_frame(cpu);
+        if (read_resync && !real_read && (song_frames % read_resync) == 0) read_model_resync();
+        usb_pipeline.EndFrame();  /* goes out during the wait and the next frame */
+        if (use_fanout) fanout.EndFrame();
 
         gettimeofday(&t2, NULL);
 
@@ -1054,5 +2222,19 @@ int main(int argc, char *argv[])
         gettimeofday(&t4, NULL);
     }
 
+    if (stop && (usb_pipeline.IsRunning() || fanout.IsOpen())) exitPlayer();
+    init_pool.reset();
+    if (sid_log.IsOpen())
+    {
+        bool written = sid_log.Close();
+        printf("\nRecorded %llu log entries to %s\n", (unsigned long long)sid_log.GetEntries(), record_file.c_str());
+        if (sid_log.GetExtraBlocks())
+            printf("Recording needed %llu extra buffers, the disk was slower than the player\n", (unsigned long long)sid_log.GetExtraBlocks());
+        if (!written)
+        {
+            cerr << "error writing " << record_file << endl;
+            return 1;
+        }
+    }
     return 0;
 }
@@ -0,0 +1,357 @@
+//============================================================================
+// Description : Loopback stand-in for the USBSID-Pico driver
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "USBSID.h"
+
+static const char *call_names[MOCK_CALL_TYPES] = {
+    "init", "close", "transfer", "write", "ring", "flush", "read",
+    "mute", "unmute", "clearbus", "stereo", "setclock", "getclock", "query"
+};
+
+static const char *query_names[] = {
+    "socketconfig", "socketsids", "sockettype1", "sockettype2", "numsids", "fmoplsid", "pcbversion"
+};
+
+enum { Q_CONFIG, Q_SOCKET_SIDS, Q_TYPE1, Q_TYPE2, Q_NUM_SIDS, Q_FMOPL, Q_PCB };
+
+/* one log for all instances, lines are tagged with the instance */
+static FILE *mock_log()
+{
+    static FILE *log = [] {
+        const char *path = getenv("USBSID_MOCK_LOG");
+        if (!path || !*path) return (FILE *)nullptr;
+        if (!strcmp(path, "-")) return stderr;
+        FILE *f = fopen(path, "w");
+        if (!f) fprintf(stderr, "USBSID mock: cannot write %s\n", path);
+        return f;
+    }();
+    return log;
+}
+
+static int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    return (value && *value) ? atoi(value) : fallback;
+}
+
+namespace USBSID_NS
+{
+    USBSID_Class::USBSID_Class()
+    {
+        static std::atomic<int> instances(0);
+        instance = instances++;
+        opened = withCycles = false;
+        clockRate = 1000000;
+        numSids = std::min(std::max(env_int("USBSID_MOCK_SIDS", 4), 1), MOCK_MAX_SIDS);
+        chipType = env_int("USBSID_MOCK_CHIP", 8580) == 6581 ? 1 : 2;
+        latencyUs = std::max(env_int("USBSID_MOCK_LATENCY", 0), 0);
+        absent = env_int("USBSID_MOCK_ABSENT", 0) != 0;
+        memset(regs, 0, sizeof(regs));
+        memset(bus, 0, sizeof(bus));
+        memset(chipCycles, 0, sizeof(chipCycles));
+        memset(counts, 0, sizeof(counts));
+        ringCycles = clockBase = 0;
+        created = clockStart = std::chrono::steady_clock::now();
+    }
+
+    USBSID_Class::~USBSID_Class()
+    {
+        if (opened) USBSID_Close();
+        FILE *log = mock_log();
+        if (log && counts[MOCK_INIT]) {
+            fprintf(log, "%d summary", instance);
+            for (int t = 0; t < MOCK_CALL_TYPES; t++) {
+                if (counts[t]) fprintf(log, " %s %llu", call_names[t], (unsigned long long)counts[t]);
+            }
+            fprintf(log, "\n");
+            fflush(log);
+        }
+    }
+
+    /* with lock held */
+    void USBSID_Class::Record(uint8_t type, uint16_t reg, uint8_t value, uint32_t arg)
+    {
+        USBSID_MockCall call;
+        call.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created).count();
+        call.type = type;
+        call.reg = reg;
+        call.value = value;
+        call.arg = arg;
+        counts[type]++;
+        if (calls.size() < MOCK_RECORD_MAX) calls.push_back(call);
+
+        FILE *log = mock_log();
+        if (!log) return;
+        switch (type) {
+            case MOCK_INIT:
+                fprintf(log, "%d %llu init threaded %d cycles %u\n", instance, (unsigned long long)call.us, value, arg);
+                break;
+            case MOCK_TRANSFER:
+                fprintf(log, "%d %llu transfer %u\n", instance, (unsigned long long)call.us, arg);
+                break;
+            case MOCK_WRITE:
+            case MOCK_READ:
+                fprintf(log, "%d %llu %s $%02X $%02X\n", instance, (unsigned long long)call.us, call_names[type], reg, value);
+                break;
+            case MOCK_RING:
+                fprintf(log, "%d %llu ring $%02X $%02X +%u\n", instance, (unsigned long long)call.us, reg, value, arg);
+                break;
+            case MOCK_SETCLOCK:
+                fprintf(log, "%d %llu setclock %u suspend %d\n", instance, (unsigned long long)call.us, arg, value);
+                break;
+            case MOCK_QUERY:
+                fprintf(log, "%d %llu query %s %u\n", instance, (unsigned long long)call.us, query_names[reg], arg);
+                break;
+            default:
+                fprintf(log, "%d %llu %s\n", instance, (unsigned long long)call.us, call_names[type]);
+                break;
+        }
+    }
+
+    /* a blocking transfer takes the set latency, one at a time like the bulk endpoint */
+    void USBSID_Class::Transfer()
+    {
+        unsigned us = latencyUs;
+        if (us == 0) return;
+        std::lock_guard<std::mutex> guard(busLock);
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    /* with lock held; cycled writes carry the device clock, else it runs in real time */
+    uint64_t USBSID_Class::DeviceCycles()
+    {
+        if (withCycles) return ringCycles;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clockStart).count();
+        return clockBase + (uint64_t)(seconds * clockRate);
+    }
+
+    /* with lock held */
+    void USBSID_Class::Store(uint16_t reg, uint8_t value)
+    {
+        int slot = (reg >> 5) & (MOCK_MAX_SIDS - 1);
+        uint8_t r = reg & 0x1F;
+        regs[slot][r] = value;
+        bus[slot] = value;
+        if (r > 0x18) return;  /* read only */
+        uint64_t now = DeviceCycles();
+        if (now > chipCycles[slot]) chips[slot].Clock(now - chipCycles[slot]);
+        chipCycles[slot] = now;
+        chips[slot].Write(r, value);
+    }
+
+    int USBSID_Class::USBSID_Init(bool start_threaded, bool with_cycles)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_INIT, 0, start_threaded, with_cycles);
+        if (absent) return -1;
+        opened = true;
+        withCycles = with_cycles;
+        memset(regs, 0, sizeof(regs));
+        memset(bus, 0, sizeof(bus));
+        memset(chipCycles, 0, sizeof(chipCycles));
+        for (int i = 0; i < MOCK_MAX_SIDS; i++) {
+            chips[i].Reset(chipType == 1 ? SIDEMU_6581 : SIDEMU_8580, 44100);
+        }
+        ringCycles = clockBase = 0;
+        clockStart = std::chrono::steady_clock::now();
+        fprintf(stderr, "USBSID-Pico loopback mock %d: %d SIDs, %u us per transfer\n", instance, numSids, (unsigned)latencyUs);
+        return 0;
+    }
+
+    int USBSID_Class::USBSID_Close(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_CLOSE, 0, 0, 0);
+        opened = false;
+        return 0;
+    }
+
+    void USBSID_Class::USBSID_Mute(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_MUTE, 0, 0, 0);
+    }
+
+    void USBSID_Class::USBSID_UnMute(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_UNMUTE, 0, 0, 0);
+    }
+
+    void USBSID_Class::USBSID_ClearBus(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_CLEARBUS, 0, 0, 0);
+    }
+
+    void USBSID_Class::USBSID_ToggleStereo(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_STEREO, 0, 0, 0);
+    }
+
+    void USBSID_Class::USBSID_SetClockRate(long clockrate_cycles, bool suspend_sids)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_SETCLOCK, 0, suspend_sids, clockrate_cycles);
+        clockBase = DeviceCycles();  /* the new rate from here on */
+        clockStart = std::chrono::steady_clock::now();
+        clockRate = clockrate_cycles > 0 ? clockrate_cycles : 1000000;
+    }
+
+    long USBSID_Class::USBSID_GetClockRate(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_GETCLOCK, 0, 0, clockRate);
+        return clockRate;
+    }
+
+    uint8_t *USBSID_Class::USBSID_GetSocketConfig(uint8_t socket_config[])
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_CONFIG, 0, 0);
+        memset(socket_config, 0, 10);
+        socket_config[1] = std::min(numSids, 2);
+        socket_config[2] = chipType;
+        socket_config[3] = numSids >= 2 ? chipType : 0;
+        socket_config[5] = std::max(numSids - 2, 0);
+        socket_config[6] = numSids >= 3 ? chipType : 0;
+        socket_config[7] = numSids >= 4 ? chipType : 0;
+        return socket_config;
+    }
+
+    int USBSID_Class::USBSID_GetSocketNumSIDS(int socket, uint8_t socket_config[])
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_SOCKET_SIDS, 0, socket);
+        return socket_config[socket == 2 ? 5 : 1];
+    }
+
+    int USBSID_Class::USBSID_GetSocketSIDType1(int socket, uint8_t socket_config[])
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_TYPE1, 0, socket);
+        return socket_config[socket == 2 ? 6 : 2];
+    }
+
+    int USBSID_Class::USBSID_GetSocketSIDType2(int socket, uint8_t socket_config[])
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_TYPE2, 0, socket);
+        return socket_config[socket == 2 ? 7 : 3];
+    }
+
+    int USBSID_Class::USBSID_GetNumSIDs(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_NUM_SIDS, 0, numSids);
+        return numSids;
+    }
+
+    int USBSID_Class::USBSID_GetFMOplSID(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_FMOPL, 0, 0);
+        return -1;  /* no FMOpl */
+    }
+
+    int USBSID_Class::USBSID_GetPCBVersion(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_QUERY, Q_PCB, 0, 13);
+        return 13;
+    }
+
+    void USBSID_Class::USBSID_Write(unsigned char *buff, size_t len)
+    {
+        Transfer();
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_TRANSFER, 0, len ? buff[0] : 0, len);
+        if (len < 3 || (buff[0] >> 6) != 0) return;  /* not a write command */
+        size_t count = buff[0] & 0x3F;
+        if (count == 0) count = 2;  /* { 0, addr, value } */
+        for (size_t i = 1; i + 1 < len && i < count + 1; i += 2) {
+            Store(buff[i], buff[i + 1]);
+            Record(MOCK_WRITE, buff[i], buff[i + 1], 0);
+        }
+    }
+
+    unsigned char USBSID_Class::USBSID_Read(unsigned char *writebuff)
+    {
+        Transfer();
+        std::lock_guard<std::mutex> guard(lock);
+        int slot = (writebuff[1] >> 5) & (MOCK_MAX_SIDS - 1);
+        uint8_t r = writebuff[1] & 0x1F;
+        uint8_t value;
+        if (r == 0x1B || r == 0x1C) {
+            uint64_t now = DeviceCycles();
+            if (now > chipCycles[slot]) chips[slot].Clock(now - chipCycles[slot]);
+            chipCycles[slot] = now;
+            value = chips[slot].Read(r);
+        } else if (r == 0x19 || r == 0x1A) {
+            value = 0xFF;  /* no paddles */
+        } else {
+            value = bus[slot];
+        }
+        Record(MOCK_READ, writebuff[1], value, 0);
+        return value;
+    }
+
+    void USBSID_Class::USBSID_WriteRing(uint16_t reg, uint8_t val)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Store(reg, val);
+        Record(MOCK_RING, reg, val, 0);
+    }
+
+    void USBSID_Class::USBSID_WriteRingCycled(uint16_t reg, uint8_t val, uint16_t cycles)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ringCycles += cycles;  /* since the previous write */
+        Store(reg, val);
+        Record(MOCK_RING, reg, val, cycles);
+    }
+
+    void USBSID_Class::USBSID_SetFlush(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_FLUSH, 0, 0, 0);
+    }
+
+    void USBSID_Class::USBSID_Flush(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Record(MOCK_FLUSH, 0, 0, 0);
+    }
+
+    std::vector<USBSID_MockCall> USBSID_Class::USBSID_MockGetCalls(void)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return calls;
+    }
+
+    uint64_t USBSID_Class::USBSID_MockCount(int type)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return (type >= 0 && type < MOCK_CALL_TYPES) ? counts[type] : 0;
+    }
+
+    uint8_t USBSID_Class::USBSID_MockGetRegister(uint16_t reg)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return regs[(reg >> 5) & (MOCK_MAX_SIDS - 1)][reg & 0x1F];
+    }
+
+    void USBSID_Class::USBSID_MockSetLatency(unsigned us)
+    {
+        latencyUs = us;
+    }
+}
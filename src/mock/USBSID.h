@@ -0,0 +1,127 @@
+//============================================================================
+// Description : Loopback stand-in for the USBSID-Pico driver
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// Has the USBSID_Class calls the player makes, with no USB behind them:
+// every call is recorded, the register writes go to a register model per
+// SID and reads are answered from it, OSC3/ENV3 by a software SID
+// running on the device clock. Build with cmake -DUSBSID_MOCK=ON to play
+// through it instead of the driver. Set at run time by environment:
+//
+//   USBSID_MOCK_LOG=<file>    every call as a line of text, - for stderr
+//   USBSID_MOCK_LATENCY=<us>  time a transfer (Write, Read) blocks, default 0
+//   USBSID_MOCK_SIDS=<n>      SIDs on the board, 1 to 4, default 4
+//   USBSID_MOCK_CHIP=6581     SID model of the sockets, default 8580
+//   USBSID_MOCK_ABSENT=1      USBSID_Init fails as without a board
+//
+// The socket configuration is the mock's own: bytes 1-3 hold the SIDs of
+// socket one and their types (1 6581, 2 8580), bytes 5-7 socket two.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "SidEmu.h"
+
+#define MOCK_MAX_SIDS   4
+#define MOCK_RECORD_MAX (1 << 20)  // calls kept for USBSID_MockGetCalls, the rest only counted
+
+enum USBSID_MockCallType
+{
+    MOCK_INIT,      /* value: threaded, arg: with cycles */
+    MOCK_CLOSE,
+    MOCK_TRANSFER,  /* a USBSID_Write, arg: bytes */
+    MOCK_WRITE,     /* one register of a transfer */
+    MOCK_RING,      /* USBSID_WriteRing(Cycled), arg: cycles */
+    MOCK_FLUSH,
+    MOCK_READ,      /* value: the answer */
+    MOCK_MUTE,
+    MOCK_UNMUTE,
+    MOCK_CLEARBUS,
+    MOCK_STEREO,
+    MOCK_SETCLOCK,  /* arg: clock rate, value: suspend */
+    MOCK_GETCLOCK,
+    MOCK_QUERY,     /* socket configuration and board info, reg: which */
+    MOCK_CALL_TYPES
+};
+
+struct USBSID_MockCall
+{
+    uint64_t us;    /* since the instance was made */
+    uint32_t arg;
+    uint16_t reg;   /* SID slot * 0x20 + register */
+    uint8_t type;
+    uint8_t value;
+};
+
+namespace USBSID_NS
+{
+    class USBSID_Class
+    {
+    private:
+        int instance;
+        bool opened;
+        bool withCycles;
+        long clockRate;
+        int numSids;
+        int chipType;    /* 1 6581, 2 8580 */
+        std::atomic<unsigned> latencyUs;
+        bool absent;
+        uint8_t regs[MOCK_MAX_SIDS][32];
+        uint8_t bus[MOCK_MAX_SIDS];  /* last value written, what write only registers read as */
+        SidChip chips[MOCK_MAX_SIDS];
+        uint64_t chipCycles[MOCK_MAX_SIDS];
+        uint64_t ringCycles;  /* device clock of the cycled writes */
+        std::chrono::steady_clock::time_point created;
+        std::chrono::steady_clock::time_point clockStart;  /* device clock of the plain writes, */
+        uint64_t clockBase;                                 /* which was here at clockStart */
+        std::mutex lock;
+        std::mutex busLock;  /* one transfer at a time */
+        std::vector<USBSID_MockCall> calls;
+        uint64_t counts[MOCK_CALL_TYPES];
+
+        void Record(uint8_t type, uint16_t reg, uint8_t value, uint32_t arg);
+        void Transfer();
+        uint64_t DeviceCycles();
+        void Store(uint16_t reg, uint8_t value);
+
+    public:
+        USBSID_Class();
+        ~USBSID_Class();
+
+        int USBSID_Init(bool start_threaded, bool with_cycles);
+        int USBSID_Close(void);
+        void USBSID_Mute(void);
+        void USBSID_UnMute(void);
+        void USBSID_ClearBus(void);
+        void USBSID_ToggleStereo(void);
+        void USBSID_SetClockRate(long clockrate_cycles, bool suspend_sids);
+        long USBSID_GetClockRate(void);
+        uint8_t *USBSID_GetSocketConfig(uint8_t socket_config[]);
+        int USBSID_GetSocketNumSIDS(int socket, uint8_t socket_config[]);
+        int USBSID_GetSocketSIDType1(int socket, uint8_t socket_config[]);
+        int USBSID_GetSocketSIDType2(int socket, uint8_t socket_config[]);
+        int USBSID_GetNumSIDs(void);
+        int USBSID_GetFMOplSID(void);
+        int USBSID_GetPCBVersion(void);
+        void USBSID_Write(unsigned char *buff, size_t len);
+        unsigned char USBSID_Read(unsigned char *writebuff);
+        void USBSID_WriteRing(uint16_t reg, uint8_t val);
+        void USBSID_WriteRingCycled(uint16_t reg, uint8_t val, uint16_t cycles);
+        void USBSID_SetFlush(void);
+        void USBSID_Flush(void);
+
+        /* mock only, for tests and benchmarks */
+        std::vector<USBSID_MockCall> USBSID_MockGetCalls(void);
+        uint64_t USBSID_MockCount(int type);
+        uint8_t USBSID_MockGetRegister(uint16_t reg);
+        void USBSID_MockSetLatency(unsigned us);
+    };
+}
@@ -9,23 +9,24 @@
 #define ZERO      0x02
 #define CARRY     0x01
 
-#define SET_NEGATIVE(x) (x ? (status |= NEGATIVE) : (status &= (~NEGATIVE)) )
-#define SET_OVERFLOW(x) (x ? (status |= OVERFLOW) : (status &= (~OVERFLOW)) )
+// N, Z, C and V live outside 'status': nflag holds N in bit 7, zflag is
+// the last result (Z is set when it is zero), cflag and vflag are 0 or 1
+#define SET_NZ(x) (nflag = zflag = (uint8_t)(x))
+#define SET_OVERFLOW(x) (vflag = (x) ? 1 : 0)
 //#define SET_CONSTANT(x) (x ? (status |= CONSTANT) : (status &= (~CONSTANT)) )
 //#define SET_BREAK(x) (x ? (status |= BREAK) : (status &= (~BREAK)) )
 #define SET_DECIMAL(x) (x ? (status |= DECIMAL) : (status &= (~DECIMAL)) )
 #define SET_INTERRUPT(x) (x ? (status |= INTERRUPT) : (status &= (~INTERRUPT)) )
-#define SET_ZERO(x) (x ? (status |= ZERO) : (status &= (~ZERO)) )
-#define SET_CARRY(x) (x ? (status |= CARRY) : (status &= (~CARRY)) )
+#define SET_CARRY(x) (cflag = (x) ? 1 : 0)
 
-#define IF_NEGATIVE() ((status & NEGATIVE) ? true : false)
-#define IF_OVERFLOW() ((status & OVERFLOW) ? true : false)
+#define IF_NEGATIVE() ((nflag & 0x80) ? true : false)
+#define IF_OVERFLOW() (vflag ? true : false)
 #define IF_CONSTANT() ((status & CONSTANT) ? true : false)
 #define IF_BREAK() ((status & BREAK) ? true : false)
 #define IF_DECIMAL() ((status & DECIMAL) ? true : false)
 #define IF_INTERRUPT() ((status & INTERRUPT) ? true : false)
-#define IF_ZERO() ((status & ZERO) ? true : false)
-#define IF_CARRY() ((status & CARRY) ? true : false)
+#define IF_ZERO() (zflag ? false : true)
+#define IF_CARRY() (cflag ? true : false)
 
 mos6502::Instr mos6502::InstrTable[256];
 
@@ -40,10 +41,33 @@ mos6502::mos6502(BusRead r, BusWrite w, ClockCycle c)
 	Read = (BusRead)r;
 	Cycle = (ClockCycle)c;
 
-	static bool initialized = false;
-	if (initialized) return;
-	initialized = true;
+	static const DecimalTables* tables = BuildDecimalTables();
+	decimalTables = tables;
 
+	ram = nullptr;
+	for(int i = 0; i < 256; i++)
+	{
+		pageFlags[i] = 0;
+		dirtyPages[i] = 1;
+	}
+	cycleInterval = 1;
+	cycleAcc = 0;
+	rtiLimit = 0;
+	idleSkip = false;
+	idleCycles = 0;
+	IdleReset();
+	codeWrites = 0;
+	blockHits = 0;
+	blockMisses = 0;
+	BlockReset();
+
+	// filled once, also when the first CPUs are made on several threads
+	static const bool tableBuilt = BuildInstrTable();
+	(void)tableBuilt;
+}
+
+bool mos6502::BuildInstrTable()
+{
 	Instr instr;
 	// fill jump table with ILLEGALs
 	instr.addr = &mos6502::Addr_IMP;
@@ -715,7 +739,44 @@ mos6502::mos6502(BusRead r, BusWrite w, ClockCycle c)
 	instr.cycles = 2;
 	InstrTable[0x98] = instr;
 
-	return;
+	return true;
+}
+
+// Decimal mode as implemented by the NMOS 6502, see "Decimal Mode" by
+// Bruce Clark, appendix A: the accumulator and carry of ADC follow
+// sequence 1, its N and V flags the signed intermediate of sequence 2.
+// SBC produces the accumulator of sequence 3 with binary mode flags.
+const mos6502::DecimalTables* mos6502::BuildDecimalTables()
+{
+	DecimalTables* t = new DecimalTables();
+
+	for(int c = 0; c < 2; c++)
+	{
+		for(int a = 0; a < 256; a++)
+		{
+			for(int m = 0; m < 256; m++)
+			{
+				int i = (c << 16) | (a << 8) | m;
+
+				int al = (a & 0x0F) + (m & 0x0F) + c;
+				if (al >= 0x0A) al = ((al + 0x06) & 0x0F) + 0x10;
+				int sum = (a & 0xF0) + (m & 0xF0) + al;
+				int ssum = (int8_t)(a & 0xF0) + (int8_t)(m & 0xF0) + al;
+				if (sum >= 0xA0) sum += 0x60;
+				t->adc[i] = (sum & 0xFF) |
+					(sum >= 0x100 ? 1 << 13 : 0) |
+					(ssum < -128 || ssum > 127 ? 1 << 14 : 0) |
+					((ssum & 0x80) << 8);
+
+				al = (a & 0x0F) - (m & 0x0F) + c - 1;
+				if (al < 0) al = ((al - 0x06) & 0x0F) - 0x10;
+				int diff = (a & 0xF0) - (m & 0xF0) + al;
+				if (diff < 0) diff -= 0x60;
+				t->sbc[i] = diff & 0xFF;
+			}
+		}
+	}
+	return t;
 }
 
 uint16_t mos6502::Addr_ACC()
@@ -734,8 +795,8 @@ uint16_t mos6502::Addr_ABS()
 	uint16_t addrH;
 	uint16_t addr;
 
-	addrL = Read(pc++);
-	addrH = Read(pc++);
+	addrL = Load(pc++);
+	addrH = Load(pc++);
 
 	addr = addrL + (addrH << 8);
 
@@ -744,7 +805,7 @@ uint16_t mos6502::Addr_ABS()
 
 uint16_t mos6502::Addr_ZER()
 {
-	return Read(pc++);
+	return Load(pc++);
 }
 
 uint16_t mos6502::Addr_IMP()
@@ -757,7 +818,7 @@ uint16_t mos6502::Addr_REL()
 	uint16_t offset;
 	uint16_t addr;
 
-	offset = (uint16_t)Read(pc++);
+	offset = (uint16_t)Load(pc++);
 	if (offset & 0x80) offset |= 0xFF00;
 	addr = pc + (int16_t)offset;
 	return addr;
@@ -772,17 +833,17 @@ uint16_t mos6502::Addr_ABI()
 	uint16_t abs;
 	uint16_t addr;
 
-	addrL = Read(pc++);
-	addrH = Read(pc++);
+	addrL = Load(pc++);
+	addrH = Load(pc++);
 
 	abs = (addrH << 8) | addrL;
 
-	effL = Read(abs);
+	effL = Load(abs);
 
 #ifndef CMOS_INDIRECT_JMP_FIX
-	effH = Read((abs & 0xFF00) + ((abs + 1) & 0x00FF) );
+	effH = Load((abs & 0xFF00) + ((abs + 1) & 0x00FF) );
 #else
-	effH = Read(abs + 1);
+	effH = Load(abs + 1);
 #endif
 
 	addr = effL + 0x100 * effH;
@@ -792,13 +853,13 @@ uint16_t mos6502::Addr_ABI()
 
 uint16_t mos6502::Addr_ZEX()
 {
-	uint16_t addr = (Read(pc++) + X) & 0xFF;
+	uint16_t addr = (Load(pc++) + X) & 0xFF;
 	return addr;
 }
 
 uint16_t mos6502::Addr_ZEY()
 {
-	uint16_t addr = (Read(pc++) + Y) & 0xFF;
+	uint16_t addr = (Load(pc++) + Y) & 0xFF;
 	return addr;
 }
 
@@ -808,8 +869,8 @@ uint16_t mos6502::Addr_ABX()
 	uint16_t addrL;
 	uint16_t addrH;
 
-	addrL = Read(pc++);
-	addrH = Read(pc++);
+	addrL = Load(pc++);
+	addrH = Load(pc++);
 
 	addr = addrL + (addrH << 8) + X;
 	return addr;
@@ -821,8 +882,8 @@ uint16_t mos6502::Addr_ABY()
 	uint16_t addrL;
 	uint16_t addrH;
 
-	addrL = Read(pc++);
-	addrH = Read(pc++);
+	addrL = Load(pc++);
+	addrH = Load(pc++);
 
 	addr = addrL + (addrH << 8) + Y;
 	return addr;
@@ -835,9 +896,9 @@ uint16_t mos6502::Addr_INX()
 	uint16_t zeroH;
 	uint16_t addr;
 
-	zeroL = (Read(pc++) + X) & 0xFF;
+	zeroL = (Load(pc++) + X) & 0xFF;
 	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8);
+	addr = Load(zeroL) + (Load(zeroH) << 8);
 
 	return addr;
 }
@@ -848,9 +909,9 @@ uint16_t mos6502::Addr_INY()
 	uint16_t zeroH;
 	uint16_t addr;
 
-	zeroL = Read(pc++);
+	zeroL = Load(pc++);
 	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8) + Y;
+	addr = Load(zeroL) + (Load(zeroH) << 8) + Y;
 
 	return addr;
 }
@@ -862,13 +923,13 @@ void mos6502::Reset()
 	X = reset_X;
 
 	// load PC from reset vector
-	uint8_t pcl = Read(rstVectorL);
-	uint8_t pch = Read(rstVectorH);
+	uint8_t pcl = Load(rstVectorL);
+	uint8_t pch = Load(rstVectorH);
 	pc = (pch << 8) + pcl;
 
 	sp = reset_sp;
 
-	status = reset_status | CONSTANT | BREAK;
+	SetP(reset_status | CONSTANT | BREAK);
 
 	illegalOpcode = false;
 
@@ -877,7 +938,7 @@ void mos6502::Reset()
 
 void mos6502::StackPush(uint8_t byte)
 {
-	Write(0x0100 + sp, byte);
+	Store(0x0100 + sp, byte);
 	if(sp == 0x00) sp = 0xFF;
 	else sp--;
 }
@@ -886,7 +947,7 @@ uint8_t mos6502::StackPop()
 {
 	if(sp == 0xFF) sp = 0x00;
 	else sp++;
-	return Read(0x0100 + sp);
+	return Load(0x0100 + sp);
 }
 
 void mos6502::IRQ()
@@ -896,12 +957,12 @@ void mos6502::IRQ()
 		//SET_BREAK(0);
 		StackPush((pc >> 8) & 0xFF);
 		StackPush(pc & 0xFF);
-		StackPush((status & ~BREAK) | CONSTANT);
+		StackPush((GetP() & ~BREAK) | CONSTANT);
 		SET_INTERRUPT(1);
 
 		// load PC from interrupt request vector
-		uint8_t pcl = Read(irqVectorL);
-		uint8_t pch = Read(irqVectorH);
+		uint8_t pcl = Load(irqVectorL);
+		uint8_t pch = Load(irqVectorH);
 		pc = (pch << 8) + pcl;
 	}
 	return;
@@ -912,112 +973,644 @@ void mos6502::NMI()
 	//SET_BREAK(0);
 	StackPush((pc >> 8) & 0xFF);
 	StackPush(pc & 0xFF);
-	StackPush((status & ~BREAK) | CONSTANT);
+	StackPush((GetP() & ~BREAK) | CONSTANT);
 	SET_INTERRUPT(1);
 
 	// load PC from non-maskable interrupt vector
-	uint8_t pcl = Read(nmiVectorL);
-	uint8_t pch = Read(nmiVectorH);
+	uint8_t pcl = Load(nmiVectorL);
+	uint8_t pch = Load(nmiVectorH);
 	pc = (pch << 8) + pcl;
 	return;
 }
-// #include <cstdio>
+uint8_t mos6502::Load(uint16_t addr)
+{
+	if (pageFlags[addr >> 8] & PAGE_DIRECT) return ram[addr];
+	return Read(addr);
+}
+
+void mos6502::Store(uint16_t addr, uint8_t value)
+{
+	if (cache && (cache->codeMap[addr >> 3] & (1 << (addr & 7))))
+		CodeWrite(addr);
+	dirtyPages[addr >> 8] = 1;
+	if (pageFlags[addr >> 8] & PAGE_DIRECT)
+		ram[addr] = value;
+	else
+		Write(addr, value);
+}
+
+uint8_t mos6502::Step(uint8_t& opcode)
+{
+	if (cache) return StepCached(opcode);
+
+	// fetch
+	opcode = Load(pc++);
+
+	// decode
+	Instr instr = InstrTable[opcode];
+
+	// execute
+	Exec(instr);
+	return instr.cycles;
+}
+
+// Same as Step() but takes the instruction from a predecoded block. Blocks
+// end at any jump, branch or return so pc only moves sequentially inside
+// one; a write to cached code abandons the block after the writing
+// instruction, which keeps self-modifying code correct.
+uint8_t mos6502::StepCached(uint8_t& opcode)
+{
+	if (blockOp == blockEnd || blockWrites != codeWrites)
+	{
+		const Block* b = BlockLookup(pc);
+		if (!b)
+		{
+			// not cacheable, e.g. code in I/O space
+			BlockReset();
+			opcode = Load(pc++);
+			Instr instr = InstrTable[opcode];
+			Exec(instr);
+			return instr.cycles;
+		}
+		blockOp = b->ops;
+		blockEnd = b->ops + b->count;
+		blockWrites = codeWrites;
+	}
+
+	const BlockOp* op = blockOp++;
+	uint16_t src;
+	uint16_t zero;
+
+	opcode = op->opcode;
+	pc += op->length;
+	switch(op->mode)
+	{
+	case MODE_ZEX:
+		src = (op->operand + X) & 0xFF;
+		break;
+	case MODE_ZEY:
+		src = (op->operand + Y) & 0xFF;
+		break;
+	case MODE_ABX:
+		src = op->operand + X;
+		break;
+	case MODE_ABY:
+		src = op->operand + Y;
+		break;
+	case MODE_INX:
+		zero = (op->operand + X) & 0xFF;
+		src = Load(zero) + (Load((zero + 1) & 0xFF) << 8);
+		break;
+	case MODE_INY:
+		src = Load(op->operand) + (Load((op->operand + 1) & 0xFF) << 8) + Y;
+		break;
+	case MODE_ABI:
+#ifndef CMOS_INDIRECT_JMP_FIX
+		src = Load(op->operand) +
+			(Load((op->operand & 0xFF00) + ((op->operand + 1) & 0x00FF)) << 8);
+#else
+		src = Load(op->operand) + (Load(op->operand + 1) << 8);
+#endif
+		break;
+	default:
+		src = op->operand;
+		break;
+	}
+	(this->*op->code)(src);
+	return op->cycles;
+}
+
+const mos6502::Block* mos6502::BlockLookup(uint16_t addr)
+{
+	Block& b = cache->blocks[(addr ^ (addr >> 10)) & (BLOCK_SLOTS - 1)];
+
+	if (b.count && b.pc == addr &&
+		b.gen[0] == cache->lineGen[b.line[0]] &&
+		b.gen[1] == cache->lineGen[b.line[1]])
+	{
+		blockHits++;
+		return &b;
+	}
+	if (pageFlags[addr >> 8] & PAGE_VOLATILE) return nullptr;
+
+	blockMisses++;
+	b.pc = addr;
+	b.count = 0;
+	b.line[0] = b.line[1] = addr >> LINE_SHIFT;
+
+	while(b.count < BLOCK_OPS && BlockLine(b, addr))
+	{
+		uint8_t opcode = Load(addr);
+		Instr instr = InstrTable[opcode];
+		uint8_t length = InstrLength(instr);
+
+		if (!BlockLine(b, addr + length - 1)) break;
+
+		BlockOp& op = b.ops[b.count++];
+		op.code = instr.code;
+		op.mode = InstrMode(instr);
+		op.length = length;
+		op.cycles = instr.cycles;
+		op.opcode = opcode;
+		op.operand = 0;
+		if (length > 1) op.operand = Load(addr + 1);
+		if (length > 2) op.operand |= Load(addr + 2) << 8;
+		if (op.mode == MODE_IMM) op.operand = addr + 1;
+		if (op.mode == MODE_REL) op.operand = addr + 2 + (int8_t)op.operand;
+
+		for(uint16_t i = 0; i < length; i++)
+		{
+			uint16_t a = addr + i;
+			cache->codeMap[a >> 3] |= 1 << (a & 7);
+		}
+		addr += length;
+
+		// anything that may load pc ends the block
+		if (op.mode == MODE_REL || op.mode == MODE_ABI ||
+			instr.code == &mos6502::Op_JMP || instr.code == &mos6502::Op_JSR ||
+			instr.code == &mos6502::Op_RTS || instr.code == &mos6502::Op_RTI ||
+			instr.code == &mos6502::Op_BRK || instr.code == &mos6502::Op_ILLEGAL)
+		{
+			break;
+		}
+	}
+	if (!b.count) return nullptr;
+	b.gen[0] = cache->lineGen[b.line[0]];
+	b.gen[1] = cache->lineGen[b.line[1]];
+	return &b;
+}
+
+// a block may span two lines, none of them in I/O space
+bool mos6502::BlockLine(Block& b, uint16_t addr)
+{
+	uint16_t line = addr >> LINE_SHIFT;
+
+	if (line == b.line[0] || line == b.line[1]) return true;
+	if (b.line[1] != b.line[0] || (pageFlags[addr >> 8] & PAGE_VOLATILE)) return false;
+	b.line[1] = line;
+	return true;
+}
+
+void mos6502::CodeWrite(uint16_t addr)
+{
+	cache->lineGen[addr >> LINE_SHIFT]++;
+	codeWrites++;
+}
+
+void mos6502::BlockReset()
+{
+	blockOp = nullptr;
+	blockEnd = nullptr;
+}
+
+mos6502::AddrMode mos6502::InstrMode(const Instr& i)
+{
+	AddrExec a = i.addr;
+
+	if (a == &mos6502::Addr_IMM) return MODE_IMM;
+	if (a == &mos6502::Addr_ZER) return MODE_ZER;
+	if (a == &mos6502::Addr_ZEX) return MODE_ZEX;
+	if (a == &mos6502::Addr_ZEY) return MODE_ZEY;
+	if (a == &mos6502::Addr_ABS) return MODE_ABS;
+	if (a == &mos6502::Addr_ABX) return MODE_ABX;
+	if (a == &mos6502::Addr_ABY) return MODE_ABY;
+	if (a == &mos6502::Addr_REL) return MODE_REL;
+	if (a == &mos6502::Addr_INX) return MODE_INX;
+	if (a == &mos6502::Addr_INY) return MODE_INY;
+	if (a == &mos6502::Addr_ABI) return MODE_ABI;
+	return MODE_NONE;
+}
+
+// The run loops are instantiated with and without the clock callback so
+// that a CPU without one does not pay for it.
 void mos6502::Run(
 	int32_t cyclesRemaining,
 	uint64_t& cycleCount,
 	CycleMethod cycleMethod
+) {
+	if (Cycle)
+		RunLoop<true>(cyclesRemaining, cycleCount, cycleMethod);
+	else
+		RunLoop<false>(cyclesRemaining, cycleCount, cycleMethod);
+}
+
+void mos6502::RunEternally()
+{
+	if (Cycle)
+		RunEternallyLoop<true>();
+	else
+		RunEternallyLoop<false>();
+}
+
+void mos6502::RunN(uint32_t n, uint64_t& cycleCount)
+{
+	if (Cycle)
+		RunNLoop<true>(n, cycleCount);
+	else
+		RunNLoop<false>(n, cycleCount);
+}
+
+template<bool clocked>
+void mos6502::Clock(uint32_t cycles)
+{
+	if (!clocked) return;
+
+	// run clock cycle callback
+	cycleAcc += cycles;
+	if (cycleAcc >= cycleInterval)
+	{
+		Cycle(this, cycleAcc);
+		cycleAcc = 0;
+	}
+}
+
+// #include <cstdio>
+template<bool clocked>
+void mos6502::RunLoop(
+	int32_t cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
 ) {
 	uint8_t opcode;
-	Instr instr;
+	uint32_t cycles;  // an idle skip returns more than a byte
+	uint16_t opPc;
 
+	IdleReset();
+	BlockReset();
 	while(cyclesRemaining > 0 && !illegalOpcode)
 	{
 		// printf("%d %d\n", cyclesRemaining, cycleCount);
-		// fetch
-		opcode = Read(pc++);
-
-		// decode
-		instr = InstrTable[opcode];
-
-		// execute
-		Exec(instr);
-		cycleCount += instr.cycles;
+		// fetch, decode and execute
+		opPc = pc;
+		cycles = Step(opcode);
+		cycleCount += cycles;
 		cyclesRemaining -=
-			cycleMethod == CYCLE_COUNT        ? instr.cycles
+			cycleMethod == CYCLE_COUNT        ? cycles
 			/* cycleMethod == INST_COUNT */   : 1;
+		Clock<clocked>(cycles);
 
-		// run clock cycle callback
-		if (Cycle)
-			for(int i = 0; i < instr.cycles; i++)
-				Cycle(this);
+		// backward jump: skip ahead if this is an idle loop
+		if (idleSkip && pc <= opPc && IdleLoop(opPc, cycleCount) && cyclesRemaining > 0)
+		{
+			uint32_t per =
+				cycleMethod == CYCLE_COUNT        ? idleLoopCycles
+				/* cycleMethod == INST_COUNT */   : idleLoopInstrs;
+			uint32_t n = (uint32_t)cyclesRemaining / per;
+			cycles = IdleSkip(n);
+			cycleCount += cycles;
+			cyclesRemaining -= n * per;
+			Clock<clocked>(cycles);
+		}
 	}
 }
 
-void mos6502::RunEternally()
+template<bool clocked>
+void mos6502::RunEternallyLoop()
 {
 	uint8_t opcode;
-	Instr instr;
+	uint8_t cycles;
+	uint16_t opPc;
+	uint64_t cycleCount = 0;
 
+	IdleReset();
+	BlockReset();
 	while(!illegalOpcode)
 	{
-		// fetch
-		opcode = Read(pc++);
-
-		// decode
-		instr = InstrTable[opcode];
-
-		// execute
-		Exec(instr);
-
-		// run clock cycle callback
-		if (Cycle)
-			for(int i = 0; i < instr.cycles; i++)
-				Cycle(this);
+		// fetch, decode and execute
+		opPc = pc;
+		cycles = Step(opcode);
+		cycleCount += cycles;
+		Clock<clocked>(cycles);
+
+		// nothing can break an idle loop from here on
+		if (idleSkip && pc <= opPc && IdleLoop(opPc, cycleCount))
+			return;
 	}
 }
 
-void mos6502::RunN(uint32_t n, uint64_t& cycleCount)
+template<bool clocked>
+void mos6502::RunNLoop(uint32_t n, uint64_t& cycleCount)
 {
 	uint32_t c = 0;
 	uint8_t opcode = 0;
-	Instr instr;
+	uint32_t cycles;
+	uint16_t opPc;
+	uint64_t limit = rtiLimit ? cycleCount + rtiLimit : UINT64_MAX;
 
+	IdleReset();
+	BlockReset();
 	for(;;)
 	{
-		// fetch
-		opcode = Read(pc++);
-
-		// decode
-		instr = InstrTable[opcode];
-
-		// execute
-		Exec(instr);
-		cycleCount += instr.cycles;
-
-		// run clock cycle callback
-		if (Cycle)
-			for(int i = 0; i < instr.cycles; i++)
-				Cycle(this);
+		// fetch, decode and execute
+		opPc = pc;
+		cycles = Step(opcode);
+		cycleCount += cycles;
+		Clock<clocked>(cycles);
 
 		if (n == 0)
 		{
 				if (opcode == 0x40)
 						return;
+				// the RTI will never be reached
+				if (idleSkip && pc <= opPc && IdleLoop(opPc, cycleCount))
+						return;
+				if (cycleCount >= limit)
+						return;
 		}
 		else
 		{
 				if (c++ == n)
 						return;
+				if (idleSkip && pc <= opPc && IdleLoop(opPc, cycleCount))
+				{
+						uint32_t k = (n - c) / idleLoopInstrs;
+						cycles = IdleSkip(k);
+						cycleCount += cycles;
+						c += k * idleLoopInstrs;
+						Clock<clocked>(cycles);
+				}
 		}
 	}
 }
 
+void mos6502::IdleReset()
+{
+	idleChecked = false;
+	idleArmed = false;
+}
+
+// Called after a jump or branch from 'tail' back to pc. Returns true once
+// a complete iteration of pc..tail ran without leaving the loop and ended
+// with the same registers it started with: with no writes in the body and
+// only stable memory read, every following iteration is identical.
+bool mos6502::IdleLoop(uint16_t tail, uint64_t stamp)
+{
+	if ((uint16_t)(tail - pc) > 16) return false;
+
+	if (!idleChecked || pc != idleHead || tail != idleTail)
+	{
+		idleHead = pc;
+		idleTail = tail;
+		idleChecked = true;
+		idleArmed = false;
+		idleOk = IdleBody(idleHead, idleTail);
+	}
+	if (!idleOk) return false;
+
+	// the body is straight-line code, so any detour outside the loop
+	// shows up as extra cycles since the last pass through the head
+	if (idleArmed &&
+		stamp - idleStamp == idleLoopCycles &&
+		A == idleA && X == idleX && Y == idleY &&
+		sp == idleSp && GetP() == idleStatus)
+	{
+		idleStamp = stamp;
+		return true;
+	}
+
+	idleArmed = true;
+	idleStamp = stamp;
+	idleA = A;
+	idleX = X;
+	idleY = Y;
+	idleSp = sp;
+	idleStatus = GetP();
+	return false;
+}
+
+bool mos6502::IdleBody(uint16_t head, uint16_t tail)
+{
+	uint16_t len = tail - head;
+	uint16_t off = 0;
+
+	idleLoopCycles = 0;
+	idleLoopInstrs = 0;
+	for(;;)
+	{
+		uint16_t addr = head + off;
+		if (pageFlags[addr >> 8] & PAGE_VOLATILE) return false;
+		Instr i = InstrTable[Load(addr)];
+		uint8_t n = InstrLength(i);
+		uint16_t operand = 0;
+
+		if (pageFlags[(uint16_t)(addr + n - 1) >> 8] & PAGE_VOLATILE) return false;
+		if (n > 1) operand = Load(addr + 1);
+		if (n > 2) operand |= Load(addr + 2) << 8;
+
+		idleLoopCycles += i.cycles;
+		idleLoopInstrs++;
+
+		if (off == len)
+		{
+			// the instruction that jumped back
+			if (i.addr == &mos6502::Addr_REL)
+				return (uint16_t)(addr + 2 + (int8_t)operand) == head;
+			return i.code == &mos6502::Op_JMP &&
+				i.addr == &mos6502::Addr_ABS &&
+				operand == head;
+		}
+		if (!IdleSafe(i, operand)) return false;
+
+		off += n;
+		if (off > len) return false;
+	}
+}
+
+// Instructions allowed inside an idle loop: no writes, no stack, no
+// control flow and reads from non volatile pages only.
+bool mos6502::IdleSafe(const Instr& i, uint16_t operand)
+{
+	CodeExec c = i.code;
+	AddrExec a = i.addr;
+
+	if (c == &mos6502::Op_NOP || c == &mos6502::Op_CLC ||
+		c == &mos6502::Op_CLD || c == &mos6502::Op_CLI ||
+		c == &mos6502::Op_CLV || c == &mos6502::Op_SEC ||
+		c == &mos6502::Op_SED || c == &mos6502::Op_SEI ||
+		c == &mos6502::Op_TAX || c == &mos6502::Op_TAY ||
+		c == &mos6502::Op_TXA || c == &mos6502::Op_TYA ||
+		c == &mos6502::Op_TSX || c == &mos6502::Op_TXS ||
+		c == &mos6502::Op_INX || c == &mos6502::Op_INY ||
+		c == &mos6502::Op_DEX || c == &mos6502::Op_DEY ||
+		c == &mos6502::Op_ASL_ACC || c == &mos6502::Op_LSR_ACC ||
+		c == &mos6502::Op_ROL_ACC || c == &mos6502::Op_ROR_ACC)
+	{
+		return true;
+	}
+
+	if (c != &mos6502::Op_LDA && c != &mos6502::Op_LDX &&
+		c != &mos6502::Op_LDY && c != &mos6502::Op_ADC &&
+		c != &mos6502::Op_SBC && c != &mos6502::Op_AND &&
+		c != &mos6502::Op_ORA && c != &mos6502::Op_EOR &&
+		c != &mos6502::Op_CMP && c != &mos6502::Op_CPX &&
+		c != &mos6502::Op_CPY && c != &mos6502::Op_BIT)
+	{
+		return false;
+	}
+
+	if (a == &mos6502::Addr_IMM)
+		return true;
+	if (a == &mos6502::Addr_ZER || a == &mos6502::Addr_ZEX || a == &mos6502::Addr_ZEY)
+		return !(pageFlags[0x00] & PAGE_VOLATILE);
+	if (a == &mos6502::Addr_ABS)
+		return !(pageFlags[operand >> 8] & PAGE_VOLATILE);
+	if (a == &mos6502::Addr_ABX || a == &mos6502::Addr_ABY)
+		return !(pageFlags[operand >> 8] & PAGE_VOLATILE) &&
+			!(pageFlags[(uint8_t)((operand >> 8) + 1)] & PAGE_VOLATILE);
+	return false;
+}
+
+uint32_t mos6502::IdleSkip(uint32_t iterations)
+{
+	uint32_t skipped = iterations * idleLoopCycles;
+	idleStamp += skipped;
+	idleCycles += skipped;
+	return skipped;
+}
+
+uint8_t mos6502::InstrLength(const Instr& i)
+{
+	AddrExec a = i.addr;
+
+	if (a == &mos6502::Addr_ACC || a == &mos6502::Addr_IMP)
+		return 1;
+	if (a == &mos6502::Addr_ABS || a == &mos6502::Addr_ABX ||
+		a == &mos6502::Addr_ABY || a == &mos6502::Addr_ABI)
+		return 3;
+	return 2;
+}
+
 void mos6502::Exec(Instr i)
 {
 	uint16_t src = (this->*i.addr)();
 	(this->*i.code)(src);
 }
 
+void mos6502::SetPageFlags(uint8_t first, uint8_t last, uint8_t flags)
+{
+	if (!ram) flags &= ~PAGE_DIRECT;
+	for(int i = first; i <= last; i++)
+	{
+		pageFlags[i] = flags;
+	}
+}
+
+void mos6502::SetRAM(uint8_t* memory)
+{
+	ram = memory;
+	if (ram) return;
+	for(int i = 0; i < 256; i++)
+	{
+		pageFlags[i] &= ~PAGE_DIRECT;
+	}
+}
+
+void mos6502::SetCycleInterval(uint32_t cycles)
+{
+	cycleInterval = cycles ? cycles : 1;
+}
+
+void mos6502::SetRTILimit(uint32_t cycles)
+{
+	rtiLimit = cycles;
+}
+
+void mos6502::SetIdleSkip(bool enable)
+{
+	idleSkip = enable;
+}
+
+uint64_t mos6502::GetIdleCycles()
+{
+	return idleCycles;
+}
+
+void mos6502::SetBlockCache(bool enable)
+{
+	if (enable && !cache)
+	{
+		cache.reset(new BlockCache());
+	}
+	else if (!enable)
+	{
+		cache.reset();
+	}
+	BlockReset();
+}
+
+void mos6502::InvalidateCode()
+{
+	for(int i = 0; i < 256; i++)
+	{
+		dirtyPages[i] = 1;
+	}
+	if (!cache) return;
+	for(int i = 0; i < LINES; i++)
+	{
+		cache->lineGen[i]++;
+	}
+	for(int i = 0; i < 8192; i++)
+	{
+		cache->codeMap[i] = 0;
+	}
+	codeWrites++;
+}
+
+void mos6502::GetBlockStats(uint64_t& hits, uint64_t& misses)
+{
+	hits = blockHits;
+	misses = blockMisses;
+}
+
+void mos6502::GetState(State& state)
+{
+	state.pc = pc;
+	state.A = A;
+	state.X = X;
+	state.Y = Y;
+	state.sp = sp;
+	state.status = GetP();
+	state.illegalOpcode = illegalOpcode;
+}
+
+void mos6502::SetState(const State& state)
+{
+	pc = state.pc;
+	A = state.A;
+	X = state.X;
+	Y = state.Y;
+	sp = state.sp;
+	SetP(state.status);
+	illegalOpcode = state.illegalOpcode;
+	IdleReset();
+	BlockReset();
+}
+
+void mos6502::GetDirtyPages(uint64_t pages[4])
+{
+	for(int i = 0; i < 4; i++)
+	{
+		pages[i] = 0;
+	}
+	for(int i = 0; i < 256; i++)
+	{
+		if (IsPageDirty(i)) pages[i >> 6] |= (uint64_t)1 << (i & 63);
+	}
+}
+
+bool mos6502::IsPageDirty(uint8_t page)
+{
+	return dirtyPages[page] || (pageFlags[page] & PAGE_VOLATILE);
+}
+
+void mos6502::ResetDirtyPages()
+{
+	for(int i = 0; i < 256; i++)
+	{
+		dirtyPages[i] = 0;
+	}
+}
+
 uint16_t mos6502::GetPC()
 {
     return pc;
@@ -1030,7 +1623,20 @@ uint8_t mos6502::GetS()
 
 uint8_t mos6502::GetP()
 {
-    return status;
+    return status |
+        (nflag & NEGATIVE) |
+        (vflag ? OVERFLOW : 0) |
+        (zflag ? 0 : ZERO) |
+        (cflag ? CARRY : 0);
+}
+
+void mos6502::SetP(uint8_t value)
+{
+    status = value & ~(NEGATIVE | OVERFLOW | ZERO | CARRY);
+    nflag = value;
+    vflag = (value & OVERFLOW) ? 1 : 0;
+    zflag = (value & ZERO) ? 0 : 1;
+    cflag = value & CARRY;
 }
 
 uint8_t mos6502::GetA()
@@ -1106,27 +1712,23 @@ void mos6502::Op_ILLEGAL(uint16_t src)
 
 void mos6502::Op_ADC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	unsigned int tmp = m + A + (IF_CARRY() ? 1 : 0);
-	SET_ZERO(!(tmp & 0xFF));
+	uint8_t m = Load(src);
+	unsigned int tmp = m + A + cflag;
 	if (IF_DECIMAL())
 	{
-		if (((A & 0xF) + (m & 0xF) + (IF_CARRY() ? 1 : 0)) > 9) tmp += 6;
-		SET_NEGATIVE(tmp & 0x80);
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		if (tmp > 0x99)
-		{
-			tmp += 96;
-		}
-		SET_CARRY(tmp > 0x99);
-	}
-	else
-	{
-		SET_NEGATIVE(tmp & 0x80);
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		SET_CARRY(tmp > 0xFF);
+		// NMOS: Z from the binary sum, N and V after the low nibble fixup
+		uint16_t d = decimalTables->adc[(cflag << 16) | (A << 8) | m];
+		zflag = tmp;
+		nflag = d >> 8;
+		vflag = (d >> 14) & 1;
+		cflag = (d >> 13) & 1;
+		A = d & 0xFF;
+		return;
 	}
 
+	SET_NZ(tmp);
+	vflag = ((A ^ tmp) & (m ^ tmp) & 0x80) >> 7;
+	cflag = tmp >> 8;
 	A = tmp & 0xFF;
 	return;
 }
@@ -1135,10 +1737,9 @@ void mos6502::Op_ADC(uint16_t src)
 
 void mos6502::Op_AND(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	SET_ZERO(!res);
+	SET_NZ(res);
 	A = res;
 	return;
 }
@@ -1146,13 +1747,12 @@ void mos6502::Op_AND(uint16_t src)
 
 void mos6502::Op_ASL(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	SET_CARRY(m & 0x80);
 	m <<= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 	return;
 }
 
@@ -1162,8 +1762,7 @@ void mos6502::Op_ASL_ACC(uint16_t src)
 	SET_CARRY(m & 0x80);
 	m <<= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -1198,11 +1797,10 @@ void mos6502::Op_BEQ(uint16_t src)
 
 void mos6502::Op_BIT(uint16_t src)
 {
-	uint8_t m = Read(src);
-	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	status = (status & 0x3F) | (uint8_t)(m & 0xC0) | CONSTANT | BREAK;
-	SET_ZERO(!res);
+	uint8_t m = Load(src);
+	nflag = m;
+	zflag = m & A;
+	SET_OVERFLOW(m & 0x40);
 	return;
 }
 
@@ -1238,9 +1836,9 @@ void mos6502::Op_BRK(uint16_t src)
 	pc++;
 	StackPush((pc >> 8) & 0xFF);
 	StackPush(pc & 0xFF);
-	StackPush(status | CONSTANT | BREAK);
+	StackPush(GetP() | CONSTANT | BREAK);
 	SET_INTERRUPT(1);
-	pc = (Read(irqVectorH) << 8) + Read(irqVectorL);
+	pc = (Load(irqVectorH) << 8) + Load(irqVectorL);
 	return;
 }
 
@@ -1288,38 +1886,34 @@ void mos6502::Op_CLV(uint16_t src)
 
 void mos6502::Op_CMP(uint16_t src)
 {
-	unsigned int tmp = A - Read(src);
+	unsigned int tmp = A - Load(src);
 	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	SET_NZ(tmp);
 	return;
 }
 
 void mos6502::Op_CPX(uint16_t src)
 {
-	unsigned int tmp = X - Read(src);
+	unsigned int tmp = X - Load(src);
 	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	SET_NZ(tmp);
 	return;
 }
 
 void mos6502::Op_CPY(uint16_t src)
 {
-	unsigned int tmp = Y - Read(src);
+	unsigned int tmp = Y - Load(src);
 	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	SET_NZ(tmp);
 	return;
 }
 
 void mos6502::Op_DEC(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 	return;
 }
 
@@ -1327,8 +1921,7 @@ void mos6502::Op_DEX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -1337,36 +1930,32 @@ void mos6502::Op_DEY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 	return;
 }
 
 void mos6502::Op_EOR(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	m = A ^ m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
 void mos6502::Op_INC(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 }
 
 void mos6502::Op_INX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 }
 
@@ -1374,8 +1963,7 @@ void mos6502::Op_INY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 }
 
@@ -1394,36 +1982,32 @@ void mos6502::Op_JSR(uint16_t src)
 
 void mos6502::Op_LDA(uint16_t src)
 {
-	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	uint8_t m = Load(src);
+	SET_NZ(m);
 	A = m;
 }
 
 void mos6502::Op_LDX(uint16_t src)
 {
-	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	uint8_t m = Load(src);
+	SET_NZ(m);
 	X = m;
 }
 
 void mos6502::Op_LDY(uint16_t src)
 {
-	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	uint8_t m = Load(src);
+	SET_NZ(m);
 	Y = m;
 }
 
 void mos6502::Op_LSR(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	SET_CARRY(m & 0x01);
 	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 }
 
 void mos6502::Op_LSR_ACC(uint16_t src)
@@ -1431,8 +2015,7 @@ void mos6502::Op_LSR_ACC(uint16_t src)
 	uint8_t m = A;
 	SET_CARRY(m & 0x01);
 	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1443,10 +2026,9 @@ void mos6502::Op_NOP(uint16_t src)
 
 void mos6502::Op_ORA(uint16_t src)
 {
-	uint8_t m = Read(src);
+	uint8_t m = Load(src);
 	m = A | m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1458,35 +2040,33 @@ void mos6502::Op_PHA(uint16_t src)
 
 void mos6502::Op_PHP(uint16_t src)
 {
-	StackPush(status | CONSTANT | BREAK);
+	StackPush(GetP() | CONSTANT | BREAK);
 	return;
 }
 
 void mos6502::Op_PLA(uint16_t src)
 {
 	A = StackPop();
-	SET_NEGATIVE(A & 0x80);
-	SET_ZERO(!A);
+	SET_NZ(A);
 	return;
 }
 
 void mos6502::Op_PLP(uint16_t src)
 {
-	status = StackPop() | CONSTANT | BREAK;
+	SetP(StackPop() | CONSTANT | BREAK);
 	//SET_CONSTANT(1);
 	return;
 }
 
 void mos6502::Op_ROL(uint16_t src)
 {
-	uint16_t m = Read(src);
+	uint16_t m = Load(src);
 	m <<= 1;
 	if (IF_CARRY()) m |= 0x01;
 	SET_CARRY(m > 0xFF);
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 	return;
 }
 
@@ -1497,22 +2077,20 @@ void mos6502::Op_ROL_ACC(uint16_t src)
 	if (IF_CARRY()) m |= 0x01;
 	SET_CARRY(m > 0xFF);
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
 
 void mos6502::Op_ROR(uint16_t src)
 {
-	uint16_t m = Read(src);
+	uint16_t m = Load(src);
 	if (IF_CARRY()) m |= 0x100;
 	SET_CARRY(m & 0x01);
 	m >>= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
+	SET_NZ(m);
+	Store(src, m);
 	return;
 }
 
@@ -1523,8 +2101,7 @@ void mos6502::Op_ROR_ACC(uint16_t src)
 	SET_CARRY(m & 0x01);
 	m >>= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -1533,7 +2110,7 @@ void mos6502::Op_RTI(uint16_t src)
 {
 	uint8_t lo, hi;
 
-	status = StackPop() | CONSTANT | BREAK;
+	SetP(StackPop() | CONSTANT | BREAK);
 
 	lo = StackPop();
 	hi = StackPop();
@@ -1555,22 +2132,17 @@ void mos6502::Op_RTS(uint16_t src)
 
 void mos6502::Op_SBC(uint16_t src)
 {
-	uint8_t m = Read(src);
-	unsigned int tmp = A - m - (IF_CARRY() ? 0 : 1);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
-	SET_OVERFLOW(((A ^ tmp) & 0x80) && ((A ^ m) & 0x80));
+	uint8_t m = Load(src);
+	unsigned int tmp = A - m - (cflag ^ 1);
 
+	// NMOS: all flags come from the binary difference
+	SET_NZ(tmp);
+	vflag = ((A ^ tmp) & (A ^ m) & 0x80) >> 7;
 	if (IF_DECIMAL())
-	{
-		if ( ((A & 0x0F) - (IF_CARRY() ? 0 : 1)) < (m & 0x0F)) tmp -= 6;
-		if (tmp > 0x99)
-		{
-			tmp -= 0x60;
-		}
-	}
-	SET_CARRY(tmp < 0x100);
-	A = (tmp & 0xFF);
+		A = decimalTables->sbc[(cflag << 16) | (A << 8) | m];
+	else
+		A = tmp & 0xFF;
+	cflag = tmp < 0x100;
 	return;
 }
 
@@ -1594,27 +2166,26 @@ void mos6502::Op_SEI(uint16_t src)
 
 void mos6502::Op_STA(uint16_t src)
 {
-	Write(src, A);
+	Store(src, A);
 	return;
 }
 
 void mos6502::Op_STX(uint16_t src)
 {
-	Write(src, X);
+	Store(src, X);
 	return;
 }
 
 void mos6502::Op_STY(uint16_t src)
 {
-	Write(src, Y);
+	Store(src, Y);
 	return;
 }
 
 void mos6502::Op_TAX(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -1622,8 +2193,7 @@ void mos6502::Op_TAX(uint16_t src)
 void mos6502::Op_TAY(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 	return;
 }
@@ -1631,8 +2201,7 @@ void mos6502::Op_TAY(uint16_t src)
 void mos6502::Op_TSX(uint16_t src)
 {
 	uint8_t m = sp;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -1640,8 +2209,7 @@ void mos6502::Op_TSX(uint16_t src)
 void mos6502::Op_TXA(uint16_t src)
 {
 	uint8_t m = X;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -1655,8 +2223,7 @@ void mos6502::Op_TXS(uint16_t src)
 void mos6502::Op_TYA(uint16_t src)
 {
 	uint8_t m = Y;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
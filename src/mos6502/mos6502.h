@@ -8,6 +8,7 @@
 
 #pragma once
 #include <stdint.h>
+#include <memory>
 
 class mos6502
 {
@@ -30,8 +31,23 @@ private:
 	// program counter
 	uint16_t pc;
 
-	// status register
+	// status register, without the lazily evaluated N, Z, C and V flags
 	uint8_t status;
+	uint8_t nflag;
+	uint8_t zflag;
+	uint8_t cflag;
+	uint8_t vflag;
+
+	void SetP(uint8_t value);
+
+	// NMOS decimal mode results, indexed by carry << 16 | A << 8 | operand
+	struct DecimalTables
+	{
+		uint16_t adc[0x20000]; // result | C << 13 | V << 14 | N << 15
+		uint8_t sbc[0x20000];  // result, flags are those of binary mode
+	};
+	const DecimalTables* decimalTables;
+	static const DecimalTables* BuildDecimalTables();
 
 	typedef void (mos6502::*CodeExec)(uint16_t);
 	typedef uint16_t (mos6502::*AddrExec)();
@@ -44,6 +60,7 @@ private:
 	};
 
 	static Instr InstrTable[256];
+	static bool BuildInstrTable();
 
 	void Exec(Instr i);
 
@@ -145,20 +162,109 @@ private:
 	// read/write/clock-cycle callbacks
 	typedef void (*BusWrite)(uint16_t, uint8_t);
 	typedef uint8_t (*BusRead)(uint16_t);
-	typedef void (*ClockCycle)(mos6502*);
+	// the clock callback gets the cycles elapsed since its last call
+	typedef void (*ClockCycle)(mos6502*, uint32_t);
 	BusRead Read;
 	BusWrite Write;
 	ClockCycle Cycle;
+	uint32_t cycleInterval;
+	uint32_t cycleAcc;
+
+	template<bool clocked> inline void Clock(uint32_t cycles);
 
 	// stack operations
 	inline void StackPush(uint8_t byte);
 	inline uint8_t StackPop();
 
+	// all CPU accesses go through these: plain RAM pages are accessed
+	// directly, anything else through the bus callbacks
+	uint8_t* ram;
+	inline uint8_t Load(uint16_t addr);
+	inline void Store(uint16_t addr, uint8_t value);
+
+	// basic-block cache, see StepCached()
+	enum AddrMode : uint8_t {
+		MODE_NONE, MODE_IMM, MODE_ZER, MODE_ZEX, MODE_ZEY, MODE_ABS,
+		MODE_ABX, MODE_ABY, MODE_REL, MODE_INX, MODE_INY, MODE_ABI,
+	};
+	static const int BLOCK_OPS = 16;
+	static const int BLOCK_SLOTS = 1024;
+	static const int LINE_SHIFT = 4;   // invalidation granularity, 16 bytes
+	static const int LINES = 0x10000 >> LINE_SHIFT;
+	struct BlockOp
+	{
+		CodeExec code;
+		uint16_t operand; // address, branch target or immediate address
+		AddrMode mode;
+		uint8_t length;
+		uint8_t cycles;
+		uint8_t opcode;
+	};
+	struct Block
+	{
+		uint16_t pc;
+		uint8_t count;
+		uint16_t line[2];
+		uint32_t gen[2];
+		BlockOp ops[BLOCK_OPS];
+	};
+	struct BlockCache
+	{
+		Block blocks[BLOCK_SLOTS];
+		uint32_t lineGen[LINES]; // bumped on writes to cached code
+		uint8_t codeMap[8192];  // one bit per byte decoded into a block
+	};
+	std::unique_ptr<BlockCache> cache;
+	const BlockOp* blockOp;  // next op of the block being executed
+	const BlockOp* blockEnd;
+	uint32_t codeWrites;      // writes to cached code so far
+	uint32_t blockWrites;     // codeWrites when the current block started
+	uint64_t blockHits;
+	uint64_t blockMisses;
+
+	inline uint8_t Step(uint8_t& opcode);
+	uint8_t StepCached(uint8_t& opcode);
+	const Block* BlockLookup(uint16_t addr);
+	bool BlockLine(Block& b, uint16_t addr);
+	void CodeWrite(uint16_t addr);
+	inline void BlockReset();
+	static AddrMode InstrMode(const Instr& i);
+
+	// memory page attributes as declared by the bus
+	uint8_t pageFlags[256];
+	// pages written since ResetDirtyPages(), a byte each to keep Store() cheap
+	uint8_t dirtyPages[256];
+
+	// idle-loop detection, see IdleLoop()
+	uint32_t rtiLimit;
+	bool idleSkip;
+	bool idleChecked;     // idleHead/idleTail have been analysed
+	bool idleOk;          // loop body is side effect free
+	bool idleArmed;       // registers below were saved at the loop head
+	uint16_t idleHead;
+	uint16_t idleTail;
+	uint32_t idleLoopCycles; // cycles per iteration
+	uint32_t idleLoopInstrs; // instructions per iteration
+	uint64_t idleStamp;
+	uint8_t idleA, idleX, idleY, idleSp, idleStatus;
+	uint64_t idleCycles;  // total cycles fast-forwarded
+
+	inline void IdleReset();
+	bool IdleLoop(uint16_t tail, uint64_t stamp);
+	bool IdleBody(uint16_t head, uint16_t tail);
+	bool IdleSafe(const Instr& i, uint16_t operand);
+	uint32_t IdleSkip(uint32_t iterations);
+	static uint8_t InstrLength(const Instr& i);
+
 public:
 	enum CycleMethod {
 		INST_COUNT,
 		CYCLE_COUNT,
 	};
+	enum PageFlag {
+		PAGE_VOLATILE = 0x01, // reads may change without a CPU write (I/O)
+		PAGE_DIRECT   = 0x02, // plain RAM, bypass the bus (needs SetRAM)
+	};
 	mos6502(BusRead r, BusWrite w, ClockCycle c = nullptr);
 	void NMI();
 	void IRQ();
@@ -172,6 +278,39 @@ public:
 						 // no need to worry about cycle exhaus-
 						 // tion
 	void RunN(uint32_t n, uint64_t& cycleCount);
+	// RunN(0) gives up after this many cycles without an RTI, 0 = never
+	void SetRTILimit(uint32_t cycles);
+	// call the clock callback once at least this many cycles have passed,
+	// default 1 (after every instruction)
+	void SetCycleInterval(uint32_t cycles);
+	// declare pages first..last, e.g. 0xD4..0xDF for the SID area
+	void SetPageFlags(uint8_t first, uint8_t last, uint8_t flags);
+	// the 64K backing store PAGE_DIRECT pages are read and written in
+	void SetRAM(uint8_t* memory);
+	// fast-forward tight loops without side effects to the end of the
+	// current Run/RunN budget; RunEternally and RunN(0) return instead
+	void SetIdleSkip(bool enable);
+	uint64_t GetIdleCycles();
+	// predecode straight-line code into cached blocks; memory written
+	// behind the CPU's back must be followed by InvalidateCode()
+	void SetBlockCache(bool enable);
+	void InvalidateCode();
+	void GetBlockStats(uint64_t& hits, uint64_t& misses);
+	// complete register file, to snapshot the CPU together with its RAM;
+	// restoring memory behind the CPU's back needs InvalidateCode() too
+	struct State
+	{
+		uint16_t pc;
+		uint8_t A, X, Y, sp, status;
+		bool illegalOpcode;
+	};
+	void GetState(State& state);
+	void SetState(const State& state);
+	// pages changed since ResetDirtyPages(), bit n of pages[n >> 6] for
+	// page n: written by the CPU, PAGE_VOLATILE, or any after InvalidateCode()
+	void GetDirtyPages(uint64_t pages[4]);
+	bool IsPageDirty(uint8_t page);
+	void ResetDirtyPages();
     uint16_t GetPC();
     uint8_t GetS();
     uint8_t GetP();
@@ -188,4 +327,12 @@ public:
     uint8_t GetResetA();
     uint8_t GetResetX();
     uint8_t GetResetY();
+
+private:
+	template<bool clocked> void RunLoop(
+		int32_t cycles,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod);
+	template<bool clocked> void RunEternallyLoop();
+	template<bool clocked> void RunNLoop(uint32_t n, uint64_t& cycleCount);
 };
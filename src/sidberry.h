@@ -32,6 +32,13 @@ using namespace std;
 #include <bitset>
 #include <chrono>
 #include <thread>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
 
 #include <USBSID.h>
 
@@ -154,14 +161,58 @@ void MemWrite(uint16_t addr, uint8_t byte);
 /* Main address reading function */
 uint8_t MemRead(uint16_t addr);
 
-/* Load SID file into memory */
-int load_sid(mos6502 cpu, SidFile sid, int song_number);
+/* The SID of an address for the voice 3 models, -1 if none */
+int read_model_chip(uint16_t addr);
+/* The voice 3 model answering OSC3/ENV3 reads of a SID, clocked up to cyclecount */
+SidChip &read_model_at(int chip);
+/* Reset the voice 3 models to the chip types of the tune */
+void read_model_reset(SidFile &sid);
+/* Read OSC3/ENV3 of every SID from the USBSID-Pico and correct the models */
+void read_model_resync(void);
+
+/* Load SID file into memory, or restore the Sub-Song's snapshot */
+int load_sid(mos6502 &cpu, SidFile &sid, int song_number);
+/* Take / restore a machine snapshot, restoring also rewrites the SID registers */
+void save_snapshot(mos6502 &cpu, SidSnapshot &snap);
+void restore_snapshot(mos6502 &cpu, const SidSnapshot &snap);
+/* Run the init of all other Sub-Songs on worker threads and keep their snapshots */
+void preinit_subtunes(SidFile &sid, int song_number);
+/* Write the SID register shadow in memory to the SID chips */
+void push_sid_registers(void);
+/* Run the play routine once and take a rewind snapshot when due */
+void play_frame(mos6502 &cpu);
+/* Silently emulate to target seconds into the Sub-Song, then push the SID registers */
+void seek_song(mos6502 &cpu, SidFile &sid, int song_number, int target, int *sec, int *min);
 /* Get key pressed without echo */
 int getch_noecho_special_char(void);
 /* Player state handler */
-void change_player_status(mos6502 cpu, SidFile sid, int key_press, bool *paused, bool *exit, uint8_t *mode_vol_reg, int *song_number, int *sec, int *min);
+void change_player_status(mos6502 &cpu, SidFile &sid, int key_press, bool *paused, bool *exit, uint8_t *mode_vol_reg, int *song_number, int *sec, int *min);
+
+/* Replace folders (and their subfolders if recursive) and playlists in files by the Sid Files in them */
+void expand_sid_files(std::vector<std::string> &files, bool recursive = false);
+/* Emulate seconds of every file without output or pacing and report the speed */
+int bench_songs(std::vector<std::string> &files, int song_number, int seconds);
+/* Emulate seconds of the Sub-Song unpaced, write its SID writes to record_file and/or render them to wav_file */
+int render_song(SidFile &sid, int song_number, int seconds);
+/* Render every Sub-Song of files to out_dir as wav, sidlog or sidpack on threads (0: one per core);
+   seconds 0 uses the song length cache */
+int batch_render(std::vector<std::string> &files, const std::string &out_dir, const std::string &format, int seconds, unsigned int threads);
+/* Render a recorded log to wav_file with the software SID */
+int render_log_wav(const std::string &path);
+/* Print the SID registers after every play call of seconds of the Sub-Song, unpaced */
+int dump_song(SidFile &sid, int song_number, int seconds, int format, bool changed_only);
+/* Play a recorded log with the cycle timing of the recording, no CPU */
+int replay_log(const std::string &path, int seek_to);
+/* Convert a log to the format of the out file name and report size and decode speed */
+int convert_log(const std::string &in, const std::string &out);
+/* Find song lengths of all Sub-Songs of files on all cores and update the cache */
+int analyse_songs(std::vector<std::string> &files);
 
 /* Player setup */
 void USBSIDSetup(void);
+/* SidLogWriter format for a log file name, packed for .sidpack */
+int log_format(const std::string &path);
+/* Open the selected output: USBSID-Pico, ASID or serial */
+void open_outputs(int clock_speed, bool is_pal, bool is_6581);
 
 #endif // SIDBERRY_H
@@ -0,0 +1,419 @@
+//============================================================================
+// Description : Conformance tests for the mos6502 core
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// mos6502_test functional <image> [success_pc] [start_pc] [load_addr]
+//   Runs a functional test image like Klaus Dormann's 6502_functional_test
+//   until it traps (a jump or branch to itself). Passes if the trap is the
+//   success address, defaults are for the prebuilt bin_files image:
+//   success $3469, start $0400, loaded at $0000.
+// mos6502_test decimal
+//   Runs ADC and SBC in decimal mode for every accumulator, operand and
+//   carry and checks A and NVZC against a reference NMOS model.
+// mos6502_test idle
+//   Runs a JMP to itself for 100000 cycles with the idle skip on and
+//   checks that the skipped cycles are all counted and clocked.
+// mos6502_test threads
+//   Makes the first CPUs of the process on several threads at once, as the
+//   worker pool does, and runs a short loop on each against its own RAM.
+//
+// Add --cached to run with the block cache and direct RAM pages.
+// Exit code 0 is a pass, 1 a failure, 77 a missing image (skipped).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mos6502/mos6502.h"
+
+#define TEST_SKIPPED 77
+#define FUNCTIONAL_BUDGET 200000000ULL  /* instructions before giving up */
+#define THREAD_COUNT 8
+#define IDLE_BUDGET 100000  /* cycles run over an idle loop */
+
+#define FLAG_N 0x80
+#define FLAG_V 0x40
+#define FLAG_D 0x08
+#define FLAG_Z 0x02
+#define FLAG_C 0x01
+
+static uint8_t memory[65536];
+
+static uint8_t BusRead(uint16_t addr)
+{
+    return memory[addr];
+}
+
+static void BusWrite(uint16_t addr, uint8_t byte)
+{
+    memory[addr] = byte;
+}
+
+static thread_local uint8_t *threadMemory;  /* RAM of the threads test */
+
+static uint8_t ThreadRead(uint16_t addr)
+{
+    return threadMemory[addr];
+}
+
+static void ThreadWrite(uint16_t addr, uint8_t byte)
+{
+    threadMemory[addr] = byte;
+}
+
+static uint64_t clockedCycles;  /* handed to CountClock */
+
+static void CountClock(mos6502 *cpu, uint32_t cycles)
+{
+    clockedCycles += cycles;
+}
+
+static mos6502 *new_cpu(bool cached, uint8_t *ram = memory, void (*clock)(mos6502 *, uint32_t) = nullptr)
+{
+    mos6502 *cpu = (ram == memory ? new mos6502(BusRead, BusWrite, clock) : new mos6502(ThreadRead, ThreadWrite, clock));
+    if (cached)
+    {
+        cpu->SetRAM(ram);
+        cpu->SetPageFlags(0x00, 0xFF, mos6502::PAGE_DIRECT);
+    }
+    cpu->SetBlockCache(cached);
+    cpu->SetIdleSkip(false);  /* the traps are idle loops */
+    return cpu;
+}
+
+static int test_functional(const char *image, uint16_t success, uint16_t start, uint16_t load, bool cached)
+{
+    FILE *f = fopen(image, "rb");
+    if (f == NULL)
+    {
+        printf("SKIP functional: %s not found\n", image);
+        return TEST_SKIPPED;
+    }
+    memset(memory, 0, sizeof(memory));
+    size_t size = fread(memory + load, 1, 65536 - load, f);
+    fclose(f);
+    if (size == 0)
+    {
+        printf("FAIL functional: %s is empty\n", image);
+        return 1;
+    }
+
+    std::unique_ptr<mos6502> cpu(new_cpu(cached));
+    cpu->Reset();
+    mos6502::State state;
+    cpu->GetState(state);
+    state.pc = start;
+    cpu->SetState(state);
+
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint16_t pc = start;
+    for (;;)
+    {
+        cpu->Run(1, cycles, mos6502::INST_COUNT);
+        instructions++;
+        cpu->GetState(state);
+        if (state.illegalOpcode)
+        {
+            printf("FAIL functional: illegal opcode $%02X at $%04X\n", memory[pc], pc);
+            return 1;
+        }
+        if (state.pc == pc)
+            break;  /* trapped */
+        if (instructions >= FUNCTIONAL_BUDGET)
+        {
+            printf("FAIL functional: no trap after %llu instructions, at $%04X\n",
+                   (unsigned long long)instructions, state.pc);
+            return 1;
+        }
+        pc = state.pc;
+    }
+
+    if (pc != success)
+    {
+        printf("FAIL functional: trapped at $%04X after %llu instructions, test number $%02X\n",
+               pc, (unsigned long long)instructions, memory[0x0200]);
+        return 1;
+    }
+    printf("PASS functional: success trap $%04X after %llu instructions, %llu cycles\n",
+           pc, (unsigned long long)instructions, (unsigned long long)cycles);
+    return 0;
+}
+
+// NMOS decimal mode as the chip computes it: add or subtract the binary
+// nibbles and apply the adjustments in place, as described in the 6510
+// emulation of VICE. Independent of the tables in mos6502.cpp.
+static void decimal_adc(uint8_t a, uint8_t m, bool c, uint8_t &res, uint8_t &flags)
+{
+    unsigned int tmp = (a & 0x0F) + (m & 0x0F) + c;
+    if (tmp > 0x09)
+        tmp += 0x06;
+    if (tmp <= 0x0F)
+        tmp = (tmp & 0x0F) + (a & 0xF0) + (m & 0xF0);
+    else
+        tmp = (tmp & 0x0F) + (a & 0xF0) + (m & 0xF0) + 0x10;
+    flags = 0;
+    if (((a + m + c) & 0xFF) == 0)
+        flags |= FLAG_Z;
+    if (tmp & 0x80)
+        flags |= FLAG_N;
+    if (((a ^ tmp) & 0x80) && !((a ^ m) & 0x80))
+        flags |= FLAG_V;
+    if ((tmp & 0x1F0) > 0x90)
+        tmp += 0x60;
+    if ((tmp & 0xFF0) > 0xF0)
+        flags |= FLAG_C;
+    res = tmp & 0xFF;
+}
+
+static void decimal_sbc(uint8_t a, uint8_t m, bool c, uint8_t &res, uint8_t &flags)
+{
+    unsigned int borrow = c ? 0 : 1;
+    unsigned int tmp = a - m - borrow;
+    unsigned int tmp_a = (a & 0x0F) - (m & 0x0F) - borrow;
+    if (tmp_a & 0x10)
+        tmp_a = ((tmp_a - 0x06) & 0x0F) | ((a & 0xF0) - (m & 0xF0) - 0x10);
+    else
+        tmp_a = (tmp_a & 0x0F) | ((a & 0xF0) - (m & 0xF0));
+    if (tmp_a & 0x100)
+        tmp_a -= 0x60;
+    flags = 0;
+    if (tmp < 0x100)
+        flags |= FLAG_C;
+    if ((tmp & 0xFF) == 0)
+        flags |= FLAG_Z;
+    if (tmp & 0x80)
+        flags |= FLAG_N;
+    if (((a ^ tmp) & 0x80) && ((a ^ m) & 0x80))
+        flags |= FLAG_V;
+    res = tmp_a & 0xFF;
+}
+
+static int test_decimal(bool cached)
+{
+    static const struct
+    {
+        const char *name;
+        uint8_t opcode;
+        void (*model)(uint8_t, uint8_t, bool, uint8_t &, uint8_t &);
+    } ops[] = {
+        { "ADC", 0x65, decimal_adc },  /* ADC $10 */
+        { "SBC", 0xE5, decimal_sbc },  /* SBC $10 */
+    };
+    int failures = 0;
+
+    memset(memory, 0, sizeof(memory));
+    std::unique_ptr<mos6502> cpu(new_cpu(cached));
+    cpu->Reset();
+    mos6502::State state;
+    cpu->GetState(state);
+
+    for (auto &op : ops)
+    {
+        memory[0x0200] = op.opcode;
+        memory[0x0201] = 0x10;
+        cpu->InvalidateCode();
+        for (int c = 0; c < 2; c++)
+        {
+            for (int a = 0; a < 256; a++)
+            {
+                for (int m = 0; m < 256; m++)
+                {
+                    memory[0x10] = m;
+                    state.pc = 0x0200;
+                    state.A = a;
+                    state.status = 0x20 | FLAG_D | (c ? FLAG_C : 0);
+                    cpu->SetState(state);
+                    uint64_t cycles = 0;
+                    cpu->Run(1, cycles, mos6502::INST_COUNT);
+
+                    mos6502::State after;
+                    cpu->GetState(after);
+                    uint8_t res, flags;
+                    op.model(a, m, c, res, flags);
+                    uint8_t got = after.status & (FLAG_N | FLAG_V | FLAG_Z | FLAG_C);
+                    if (after.A != res || got != flags)
+                    {
+                        if (failures < 10)
+                            printf("FAIL decimal: %s $%02X,$%02X C=%d: A=$%02X P=$%02X, expected A=$%02X P=$%02X\n",
+                                   op.name, a, m, c, after.A, got, res, flags);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    if (failures)
+    {
+        printf("FAIL decimal: %d mismatches\n", failures);
+        return 1;
+    }
+    printf("PASS decimal: ADC and SBC, %d cases\n", 2 * 2 * 256 * 256);
+    return 0;
+}
+
+static int test_idle(bool cached)
+{
+    memset(memory, 0, sizeof(memory));
+    memory[0x0200] = 0x4C;  /* JMP $0200 */
+    memory[0x0201] = 0x00;
+    memory[0x0202] = 0x02;
+    int failures = 0;
+
+    for (int clocked = 0; clocked < 2; clocked++)
+    {
+        std::unique_ptr<mos6502> cpu(new_cpu(cached, memory, clocked ? CountClock : nullptr));
+        cpu->SetIdleSkip(true);
+        cpu->Reset();
+        mos6502::State state;
+        cpu->GetState(state);
+        state.pc = 0x0200;
+        cpu->SetState(state);
+
+        uint64_t cycles = 0;
+        clockedCycles = 0;
+        cpu->Run(IDLE_BUDGET, cycles, mos6502::CYCLE_COUNT);
+        cpu->GetState(state);
+        /* the budget runs out within the last JMP */
+        if (cycles < IDLE_BUDGET || cycles > IDLE_BUDGET + 2 || state.pc != 0x0200)
+        {
+            printf("FAIL idle: %llu cycles counted for a budget of %d, at $%04X\n",
+                   (unsigned long long)cycles, IDLE_BUDGET, state.pc);
+            failures++;
+        }
+        if (clocked && clockedCycles != cycles)
+        {
+            printf("FAIL idle: %llu cycles clocked, %llu counted\n",
+                   (unsigned long long)clockedCycles, (unsigned long long)cycles);
+            failures++;
+        }
+        if (!failures && clocked)
+            printf("PASS idle: %llu cycles counted and clocked for a budget of %d\n",
+                   (unsigned long long)cycles, IDLE_BUDGET);
+    }
+    return failures ? 1 : 0;
+}
+
+// Adds the thread's number 255 times and stores the low byte, on a CPU
+// made at the same time as the other threads make theirs.
+static bool run_thread(int number, bool cached, std::atomic<int> &ready, uint8_t &result)
+{
+    static const uint8_t program[] = {
+        0xA9, 0x00,        /* $0200 LDA #$00  */
+        0xA2, 0xFF,        /*       LDX #$FF  */
+        0x18,              /* $0204 CLC       */
+        0x65, 0x10,        /*       ADC $10   */
+        0xCA,              /*       DEX       */
+        0xD0, 0xFA,        /*       BNE $0204 */
+        0x85, 0x11,        /*       STA $11   */
+        0x4C, 0x0C, 0x02,  /* $020C JMP $020C */
+    };
+    std::unique_ptr<uint8_t[]> ram(new uint8_t[65536]());
+    threadMemory = ram.get();
+    memcpy(&ram[0x0200], program, sizeof(program));
+    ram[0x10] = number;
+
+    ready--;
+    while (ready > 0)
+        ;  /* all threads construct together */
+    std::unique_ptr<mos6502> cpu(new_cpu(cached, ram.get()));
+    cpu->Reset();
+    mos6502::State state;
+    cpu->GetState(state);
+    state.pc = 0x0200;
+    cpu->SetState(state);
+
+    uint64_t cycles = 0;
+    for (int i = 0; i < 10000 && state.pc != 0x020C; i++)
+    {
+        cpu->Run(1, cycles, mos6502::INST_COUNT);
+        cpu->GetState(state);
+    }
+    result = ram[0x11];
+    return state.pc == 0x020C && !state.illegalOpcode;
+}
+
+static int test_threads(bool cached)
+{
+    std::atomic<int> ready(THREAD_COUNT);
+    std::vector<std::thread> threads;
+    uint8_t results[THREAD_COUNT] = { 0 };
+    bool trapped[THREAD_COUNT] = { false };
+
+    for (int t = 0; t < THREAD_COUNT; t++)
+    {
+        threads.emplace_back([&, t]() {
+            trapped[t] = run_thread(t + 1, cached, ready, results[t]);
+        });
+    }
+    int failures = 0;
+    for (int t = 0; t < THREAD_COUNT; t++)
+    {
+        threads[t].join();
+    }
+    for (int t = 0; t < THREAD_COUNT; t++)
+    {
+        uint8_t expected = (255 * (t + 1)) & 0xFF;
+        if (!trapped[t] || results[t] != expected)
+        {
+            printf("FAIL threads: thread %d %s, stored $%02X, expected $%02X\n",
+                   t + 1, trapped[t] ? "trapped" : "did not trap", results[t], expected);
+            failures++;
+        }
+    }
+    if (failures)
+        return 1;
+    printf("PASS threads: %d CPUs made and run at once\n", THREAD_COUNT);
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: mos6502_test functional <image> [success_pc] [start_pc] [load_addr] [--cached]\n");
+    fprintf(stderr, "       mos6502_test decimal [--cached]\n");
+    fprintf(stderr, "       mos6502_test idle [--cached]\n");
+    fprintf(stderr, "       mos6502_test threads [--cached]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool cached = false;
+    const char *args[6] = { NULL };
+    int count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cached") == 0)
+            cached = true;
+        else if (count < 6)
+            args[count++] = argv[i];
+    }
+    if (count >= 1 && strcmp(args[0], "decimal") == 0)
+    {
+        return test_decimal(cached);
+    }
+    if (count >= 1 && strcmp(args[0], "idle") == 0)
+    {
+        return test_idle(cached);
+    }
+    if (count >= 1 && strcmp(args[0], "threads") == 0)
+    {
+        return test_threads(cached);
+    }
+    if (count >= 2 && strcmp(args[0], "functional") == 0)
+    {
+        uint16_t success = count > 2 ? strtoul(args[2], NULL, 16) : 0x3469;
+        uint16_t start = count > 3 ? strtoul(args[3], NULL, 16) : 0x0400;
+        uint16_t load = count > 4 ? strtoul(args[4], NULL, 16) : 0x0000;
+        return test_functional(args[1], success, start, load, cached);
+    }
+    usage();
+    return 1;
+}
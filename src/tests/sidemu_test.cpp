@@ -0,0 +1,210 @@
+//============================================================================
+// Description : Bit exactness of the software SID's SIMD kernels
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// sidemu_test kernels
+//   Runs every kernel of each instruction set this CPU has on random
+//   blocks and compares the results with the scalar reference bit by bit.
+// sidemu_test render
+//   Renders a random stream of register writes to four chips, with sync,
+//   ring modulation, noise and test bits, once per instruction set and
+//   compares the samples with the scalar render.
+//
+// Exit code 0 is a pass, 1 a failure, 77 no SIMD kernels to compare (skipped).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "SidEmu.h"
+
+#define TEST_SKIPPED 77
+#define STEPS (SIDEMU_BLOCK * SIDEMU_SUBSTEPS)
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t rnd()
+{
+    /* xorshift32 */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static float rndf(float lo, float hi)
+{
+    return lo + (hi - lo) * (rnd() & 0xFFFFFF) / 16777216.0f;
+}
+
+/* the instruction sets to check against the scalar reference */
+static std::vector<const SidEmuKernels *> simd_kernels()
+{
+    std::vector<const SidEmuKernels *> list;
+    for (int isa : { SIDEMU_SSE41, SIDEMU_AVX2, SIDEMU_NEON }) {
+        const SidEmuKernels *k = sidemu_kernels(isa);
+        if (k) list.push_back(k);
+    }
+    return list;
+}
+
+static int test_kernels(const std::vector<const SidEmuKernels *> &list)
+{
+    const SidEmuKernels *ref = sidemu_kernels(SIDEMU_SCALAR);
+    static uint32_t ends[STEPS], acc[STEPS], source[STEPS], noise[STEPS];
+    static uint32_t accRef[STEPS], accGot[STEPS];
+    static int32_t weight[STEPS], sumsRef[SIDEMU_BLOCK], sumsGot[SIDEMU_BLOCK];
+    static int32_t filter[SIDEMU_BLOCK * SIDEMU_LANES], direct[SIDEMU_BLOCK * SIDEMU_LANES];
+    static uint16_t cycles[SIDEMU_BLOCK];
+    static float outRef[SIDEMU_BLOCK], outGot[SIDEMU_BLOCK];
+    const int rounds = 20000;
+    int failures = 0;
+
+    for (const SidEmuKernels *k : list) {
+        for (int round = 0; round < rounds && failures < 10; round++) {
+            int samples = 1 + rnd() % SIDEMU_BLOCK;
+            int steps = samples * SIDEMU_SUBSTEPS;
+
+            uint32_t total = 0;
+            for (int t = 0; t < steps; t++) {
+                total += rnd() % 33;
+                ends[t] = total;
+            }
+            uint32_t acc0 = rnd() & 0xFFFFFF, freq = rnd() & 0xFFFF;
+            ref->accumulate(acc0, freq, ends, steps, accRef);
+            k->accumulate(acc0, freq, ends, steps, accGot);
+            if (memcmp(accRef, accGot, steps * sizeof(uint32_t)) != 0) {
+                printf("FAIL kernels: %s accumulate, round %d\n", k->name, round);
+                failures++;
+            }
+
+            for (int t = 0; t < steps; t++) {
+                acc[t] = rnd() & 0xFFFFFF;
+                source[t] = rnd() & 0xFFFFFF;
+                noise[t] = rnd() & 0xFF0;
+                weight[t] = (rnd() & 0xFF) * (rnd() % 33);
+            }
+            SidWaveArgs wave;
+            wave.acc = acc;
+            wave.source = source;
+            wave.weight = weight;
+            wave.control = rnd() & 0xFF;
+            wave.noise = (wave.control & 0x80) ? noise : nullptr;
+            wave.pw = rnd() & 0xFFF;
+            wave.zero = (rnd() & 1) ? 0x380 : 0x800;
+            for (int s = 0; s < samples; s++) {
+                sumsRef[s] = sumsGot[s] = rnd() % 1000000;
+            }
+            ref->wave(wave, samples, sumsRef);
+            k->wave(wave, samples, sumsGot);
+            if (memcmp(sumsRef, sumsGot, samples * sizeof(int32_t)) != 0) {
+                printf("FAIL kernels: %s wave, control $%02X, round %d\n", k->name, wave.control, round);
+                failures++;
+            }
+
+            /* up to three voices at full level for 40 cycles */
+            for (int i = 0; i < samples * SIDEMU_LANES; i++) {
+                filter[i] = (int32_t)(rnd() % 250000000) - 125000000;
+                direct[i] = (int32_t)(rnd() % 250000000) - 125000000;
+            }
+            for (int s = 0; s < samples; s++) {
+                cycles[s] = 18 + rnd() % 23;
+            }
+            SidFilterArgs f;
+            f.filter = filter;
+            f.direct = direct;
+            f.cycles = cycles;
+            for (int l = 0; l < SIDEMU_LANES; l++) {
+                f.w[l] = rndf(0.0f, 1.4f);
+                f.damping[l] = rndf(0.4f, 1.5f);
+                f.lpMask[l] = (rnd() & 1) ? ~0u : 0;
+                f.bpMask[l] = (rnd() & 1) ? ~0u : 0;
+                f.hpMask[l] = (rnd() & 1) ? ~0u : 0;
+                f.dc[l] = (rnd() & 1) ? -0.11f : 0.0f;
+                f.gain[l] = (rnd() & 0x0F) / 15.0f;
+                f.lp[l] = (rnd() & 3) ? rndf(-2.0f, 2.0f) : 1e-13f;  /* flushed */
+                f.bp[l] = rndf(-2.0f, 2.0f);
+            }
+            SidFilterArgs got = f;
+            ref->filter(f, samples, outRef);
+            k->filter(got, samples, outGot);
+            if (memcmp(outRef, outGot, samples * sizeof(float)) != 0 || memcmp(f.lp, got.lp, sizeof(f.lp)) != 0 ||
+                memcmp(f.bp, got.bp, sizeof(f.bp)) != 0) {
+                printf("FAIL kernels: %s filter, round %d\n", k->name, round);
+                failures++;
+            }
+        }
+        if (failures == 0)
+            printf("PASS kernels: %s matches scalar in %d random blocks\n", k->name, rounds);
+    }
+    return failures ? 1 : 0;
+}
+
+/* ten seconds of random writes, mostly to the voices */
+static void render(const SidLogHeader &header, std::vector<int16_t> &out)
+{
+    SidRenderer renderer;
+    renderer.Begin(header, 44100);
+    seed = 0xC0FFEE;
+    uint64_t cycle = 0;
+    for (int chip = 0; chip < header.sid_count; chip++) {
+        renderer.Write(cycle, header.sid_addr[chip] + 0x18, 0x0F);
+    }
+    while (cycle < 10 * header.clock_hz) {
+        cycle += rnd() % 400;
+        int chip = rnd() % header.sid_count;
+        int reg = rnd() % 25;
+        uint8_t value = rnd();
+        if (reg % 7 == 4 && reg < 21 && (rnd() & 3)) value &= ~0x08;  /* test bit now and then */
+        renderer.Write(cycle, header.sid_addr[chip] + reg, value);
+    }
+    renderer.RenderTo(cycle);
+    out = renderer.GetSamples();
+}
+
+static int test_render(const std::vector<const SidEmuKernels *> &list)
+{
+    SidLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.clock_hz = 985248;
+    header.sid_count = 4;
+    for (int i = 0; i < 4; i++) {
+        header.chip_type[i] = (i & 1) ? 2 : 1;
+        header.sid_addr[i] = 0xD400 + i * 0x20;
+    }
+    std::vector<int16_t> reference, samples;
+    sidemu_set_isa(SIDEMU_SCALAR);
+    render(header, reference);
+
+    int failures = 0;
+    for (const SidEmuKernels *k : list) {
+        sidemu_set_isa(k->isa);
+        render(header, samples);
+        size_t i = 0;
+        while (i < reference.size() && i < samples.size() && reference[i] == samples[i]) i++;
+        if (i != reference.size() || samples.size() != reference.size()) {
+            printf("FAIL render: %s differs from scalar at sample %zu of %zu\n", k->name, i, reference.size());
+            failures++;
+        } else {
+            printf("PASS render: %s matches scalar, %zu samples\n", k->name, samples.size());
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || (strcmp(argv[1], "kernels") != 0 && strcmp(argv[1], "render") != 0)) {
+        fprintf(stderr, "Usage: sidemu_test kernels|render\n");
+        return 1;
+    }
+    std::vector<const SidEmuKernels *> list = simd_kernels();
+    if (list.empty()) {
+        printf("SKIP %s: no SIMD kernels on this CPU\n", argv[1]);
+        return TEST_SKIPPED;
+    }
+    return strcmp(argv[1], "kernels") == 0 ? test_kernels(list) : test_render(list);
+}
@@ -0,0 +1,195 @@
+//============================================================================
+// Description : The USB output path against the loopback USBSID-Pico
+// Author      : LouD
+// Last update : 2024
+//============================================================================
+//
+// usbmock_test pipeline
+//   Sends frames of random register writes through a UsbPipeline and
+//   checks that the mock saw them all, in order, in packets of at most
+//   64 bytes, and that its registers hold the last values.
+// usbmock_test latency
+//   With a slow transfer the frames queue behind each other: EndFrame
+//   has to wait and counts the stalls, without a frame getting lost.
+// usbmock_test read
+//   OSC3 and ENV3 of a sawtooth with a fast attack, clocked by cycled
+//   writes, read back from the mock's voice 3.
+//
+// Exit code 0 is a pass, 1 a failure.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <USBSID.h>
+
+#include "UsbPipeline.h"
+
+static uint32_t seed = 0x2468ACE1;
+
+static uint32_t rnd()
+{
+    /* xorshift32 */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void submit(void *user, uint8_t *data, size_t size)
+{
+    ((USBSID_NS::USBSID_Class *)user)->USBSID_Write(data, size);
+}
+
+static int test_pipeline()
+{
+    USBSID_NS::USBSID_Class sid;
+    sid.USBSID_MockSetLatency(0);
+    sid.USBSID_Init(false, false);
+    UsbPipeline pipeline;
+    pipeline.Start(submit, &sid);
+
+    std::vector<uint8_t> sent;
+    uint8_t last[0x80] = { 0 };
+    const int frames = 500;
+    for (int f = 0; f < frames; f++) {
+        int writes = rnd() % 80;  /* up to three packets */
+        for (int i = 0; i < writes; i++) {
+            uint8_t addr = (rnd() % 4) * 0x20 + rnd() % 25;
+            uint8_t value = rnd();
+            pipeline.Write(addr, value);
+            sent.push_back(addr);
+            sent.push_back(value);
+            last[addr] = value;
+        }
+        pipeline.EndFrame();
+    }
+    pipeline.Stop();
+
+    int failures = 0;
+    std::vector<uint8_t> seen;
+    for (const USBSID_MockCall &call : sid.USBSID_MockGetCalls()) {
+        if (call.type == MOCK_TRANSFER && call.arg > USBPIPE_PACKET) {
+            printf("FAIL pipeline: a transfer of %u bytes\n", call.arg);
+            failures++;
+        }
+        if (call.type == MOCK_WRITE) {
+            seen.push_back(call.reg);
+            seen.push_back(call.value);
+        }
+    }
+    if (seen != sent) {
+        printf("FAIL pipeline: %zu writes sent, the mock saw %zu or a different order\n", sent.size() / 2, seen.size() / 2);
+        failures++;
+    }
+    for (int addr = 0; addr < 0x80; addr++) {
+        if ((addr & 0x1F) < 25 && sid.USBSID_MockGetRegister(addr) != last[addr]) {
+            printf("FAIL pipeline: register $%02X is $%02X, last written $%02X\n", addr, sid.USBSID_MockGetRegister(addr), last[addr]);
+            failures++;
+            break;
+        }
+    }
+    UsbPipeline::Stats stats;
+    pipeline.GetStats(stats);
+    if (stats.transfers != sid.USBSID_MockCount(MOCK_TRANSFER)) {
+        printf("FAIL pipeline: %llu transfers counted, the mock saw %llu\n", (unsigned long long)stats.transfers,
+               (unsigned long long)sid.USBSID_MockCount(MOCK_TRANSFER));
+        failures++;
+    }
+    if (failures == 0)
+        printf("PASS pipeline: %zu writes in %llu transfers, %llu frames\n", sent.size() / 2,
+               (unsigned long long)stats.transfers, (unsigned long long)stats.frames);
+    return failures ? 1 : 0;
+}
+
+static int test_latency()
+{
+    USBSID_NS::USBSID_Class sid;
+    sid.USBSID_MockSetLatency(2000);
+    sid.USBSID_Init(false, false);
+    UsbPipeline pipeline;
+    pipeline.Start(submit, &sid);
+
+    /* 2 transfers of 2 ms per frame, handed over back to back */
+    const int frames = 20;
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < 40; i++) {
+            pipeline.Write(i % 25, f);
+        }
+        pipeline.EndFrame();
+    }
+    pipeline.Stop();
+
+    int failures = 0;
+    UsbPipeline::Stats stats;
+    pipeline.GetStats(stats);
+    if (stats.frames != frames || sid.USBSID_MockCount(MOCK_WRITE) != frames * 40) {
+        printf("FAIL latency: %llu of %d frames, %llu of %d writes\n", (unsigned long long)stats.frames, frames,
+               (unsigned long long)sid.USBSID_MockCount(MOCK_WRITE), frames * 40);
+        failures++;
+    }
+    if (stats.stalls < frames / 2) {
+        printf("FAIL latency: only %llu of %d frames waited for a slow transfer\n", (unsigned long long)stats.stalls, frames);
+        failures++;
+    }
+    if (stats.seconds < frames * 2 * 0.002) {
+        printf("FAIL latency: %d frames took %.3f s, less than the transfers\n", frames, stats.seconds);
+        failures++;
+    }
+    if (failures == 0)
+        printf("PASS latency: %llu of %d frames waited, %.3f s\n", (unsigned long long)stats.stalls, frames, stats.seconds);
+    return failures ? 1 : 0;
+}
+
+static int test_read()
+{
+    USBSID_NS::USBSID_Class sid;
+    sid.USBSID_MockSetLatency(0);
+    sid.USBSID_Init(true, true);
+    unsigned char osc3[3] = { 0x1, 0x1B, 0x0 }, env3[3] = { 0x1, 0x1C, 0x0 };
+
+    sid.USBSID_WriteRingCycled(0x0E, 0x00, 0);
+    sid.USBSID_WriteRingCycled(0x0F, 0x10, 0);  /* $1000, 16 cycles per OSC3 step */
+    sid.USBSID_WriteRingCycled(0x13, 0x00, 0);  /* fastest attack */
+    sid.USBSID_WriteRingCycled(0x14, 0xF0, 0);
+    sid.USBSID_WriteRingCycled(0x12, 0x21, 0);  /* sawtooth, gate */
+    int failures = 0;
+    uint8_t previous = sid.USBSID_Read(env3);
+    for (int i = 1; i <= 8; i++) {
+        sid.USBSID_WriteRingCycled(0x00, 0x00, 1000);  /* a write to voice 1 moves the clock */
+        uint8_t osc = sid.USBSID_Read(osc3);
+        uint8_t env = sid.USBSID_Read(env3);
+        int expected = (i * 1000 * 0x1000 >> 16) & 0xFF;
+        if (abs(osc - expected) > 1) {
+            printf("FAIL read: OSC3 $%02X after %d cycles, expected $%02X\n", osc, i * 1000, expected);
+            failures++;
+        }
+        if (env <= previous && previous != 0xFF) {
+            printf("FAIL read: ENV3 $%02X after $%02X, not attacking\n", env, previous);
+            failures++;
+        }
+        previous = env;
+    }
+    if (sid.USBSID_MockCount(MOCK_READ) != 17 || sid.USBSID_MockCount(MOCK_RING) != 13) {
+        printf("FAIL read: %llu reads and %llu ring writes recorded\n", (unsigned long long)sid.USBSID_MockCount(MOCK_READ),
+               (unsigned long long)sid.USBSID_MockCount(MOCK_RING));
+        failures++;
+    }
+    if (failures == 0)
+        printf("PASS read: OSC3 follows the sawtooth, ENV3 the attack\n");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: usbmock_test pipeline|latency|read\n");
+        return 1;
+    }
+    if (!strcmp(argv[1], "pipeline")) return test_pipeline();
+    if (!strcmp(argv[1], "latency")) return test_latency();
+    if (!strcmp(argv[1], "read")) return test_read();
+    fprintf(stderr, "Usage: usbmock_test pipeline|latency|read\n");
+    return 1;
+}